@@ -1,13 +1,158 @@
 #include "tsCommon.h"
 #include "tsTransportStream.h"
+#include "tsCRC.h"
+#include "tsBatch.h"
+#include "tsPacketPolicy.h"
+#include "tsPipeline.h"
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <vector>
 
-static constexpr uint16_t PID_AUDIO_MP2 = 136;
+static constexpr xTS_PacketHeader::ePID PSI_PIDs[] = {
+    xTS_PacketHeader::ePID::PAT,
+    xTS_PacketHeader::ePID::CAT,
+    xTS_PacketHeader::ePID::NIT,
+    xTS_PacketHeader::ePID::SDT,
+};
+static constexpr uint32_t NumPSI_PIDs = sizeof(PSI_PIDs) / sizeof(PSI_PIDs[0]);
+
+static int RunBatch(int argc, char *argv[ ]) {
+    xBatchConfig Config;
+    Config.Input = argv[2];
+    for (int i = 3; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            printf("Error: Brak wartości dla opcji %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--threads") == 0) {
+            Config.NumThreads = (uint32_t)strtoul(argv[i + 1], nullptr, 10);
+        } else if (strcmp(argv[i], "--pid") == 0) {
+            Config.PID = (uint16_t)strtoul(argv[i + 1], nullptr, 0);
+        } else if (strcmp(argv[i], "--report") == 0) {
+            Config.ReportPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--split-mb") == 0) {
+            Config.MinSplitBytes = (uint64_t)strtoull(argv[i + 1], nullptr, 10) << 20;
+        } else if (strcmp(argv[i], "--pid-cap-kb") == 0) {
+            Config.Memory.AssemblerCap = (uint64_t)strtoull(argv[i + 1], nullptr, 10) << 10;
+        } else if (strcmp(argv[i], "--queue-cap-mb") == 0) {
+            Config.Memory.QueueCapPerPID = (uint64_t)strtoull(argv[i + 1], nullptr, 10) << 20;
+        } else if (strcmp(argv[i], "--global-cap-mb") == 0) {
+            Config.Memory.GlobalCap = (uint64_t)strtoull(argv[i + 1], nullptr, 10) << 20;
+        } else {
+            printf("Error: Nieznana opcja %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    xBatchScheduler Scheduler(Config);
+    int32_t NumFiles = Scheduler.CollectFiles();
+    if (NumFiles == NOT_VALID) {
+        printf("Error: Nie można odnaleźć wejścia %s\n", Config.Input.c_str());
+        return EXIT_FAILURE;
+    }
+
+    printf("Przetwarzanie wsadowe %d plików dla PID %u na %u wątkach...\n", NumFiles, Config.PID, Scheduler.getNumThreads());
+    Scheduler.Run();
+    Scheduler.PrintReport(stdout);
+
+    if (!Scheduler.WriteReport()) {
+        printf("Error: Nie można zapisać raportu %s\n", Config.ReportPath.c_str());
+        return EXIT_FAILURE;
+    }
+    printf("Raport zapisany do %s\n", Config.ReportPath.c_str());
+    return EXIT_SUCCESS;
+}
+
+static int RunExtract(int argc, char *argv[ ]) {
+    xTS_PipelineDispatcher::xProfile Profile;
+    const char* InputPath = argv[2];
+    const char* OutputPath = nullptr;
+    uint64_t MaxPackets = 0;
+    xMemoryGovernor::xConfig MemoryConfig;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--verbose") == 0) {
+            Profile.Verbose = true;
+        } else if (strcmp(argv[i], "--validate") == 0) {
+            Profile.Discard = true;
+        } else if (strcmp(argv[i], "--pid") == 0 && i + 1 < argc) {
+            Profile.PID = (uint16_t)strtoul(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            MaxPackets = strtoull(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--pid-cap-kb") == 0 && i + 1 < argc) {
+            MemoryConfig.AssemblerCap = strtoull(argv[++i], nullptr, 10) << 10;
+        } else if (argv[i][0] != '-' && OutputPath == nullptr) {
+            OutputPath = argv[i];
+        } else {
+            printf("Error: Nieznana opcja %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE* TransportStreamFile = fopen(InputPath, "rb");
+    if (TransportStreamFile == NULL) {
+        printf("Error: Nie można otworzyć pliku strumienia transportowego\n");
+        return EXIT_FAILURE;
+    }
+    FILE* Output = (OutputPath && !Profile.Discard) ? fopen(OutputPath, "wb") : nullptr;
+    if (!Profile.Discard && Output == NULL) {
+        printf("Error: Nie można utworzyć pliku wyjściowego\n");
+        fclose(TransportStreamFile);
+        return EXIT_FAILURE;
+    }
+
+    xTS_PacketPolicy PacketPolicy;
+    PacketPolicy.Init();
+
+    printf("Ekstrakcja PID %u, profil %s...\n", Profile.PID, xTS_PipelineDispatcher::getName(Profile));
+    xMemoryGovernor Governor(MemoryConfig);
+    xPipelineStats Stats = xTS_PipelineDispatcher::Run(Profile, TransportStreamFile, Output, &PacketPolicy, MaxPackets, &Governor);
+
+    fclose(TransportStreamFile);
+    if (Output) {
+        fclose(Output);
+    }
+
+    printf("Pakiety=%" PRIu64 " błędy synchronizacji=%" PRIu64 " PES=%" PRIu64 " bajty=%" PRIu64 " utracone=%u przepełnienia=%u usunięte=%u błędy CRC=%u\n",
+           Stats.NumPackets, Stats.NumSyncErrors, Stats.NumPES, Stats.NumOutputBytes, Stats.NumPacketsLost,
+           Stats.NumOverflows, Stats.NumEvictions, Stats.NumPESCRCErrors);
+    PacketPolicy.Print();
+    Governor.Print(stdout);
+    return EXIT_SUCCESS;
+}
 
 int main(int argc, char *argv[ ], char *envp[ ]) {
+    if (argc >= 3 && strcmp(argv[1], "--batch") == 0) {
+        return RunBatch(argc, argv);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--extract") == 0) {
+        return RunExtract(argc, argv);
+    }
+
+    const char* QuarantinePath = nullptr;
+    const char* PassthroughPath = nullptr;
+    std::vector<uint16_t> PassthroughPIDs;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 == argc) {
+            printf("Error: Brak wartości dla opcji %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--quarantine") == 0) {
+            QuarantinePath = argv[i + 1];
+        } else if (strcmp(argv[i], "--passthrough") == 0) {
+            PassthroughPath = argv[i + 1];
+        } else if (strcmp(argv[i], "--passthrough-pid") == 0) {
+            PassthroughPIDs.push_back((uint16_t)strtoul(argv[i + 1], nullptr, 0));
+        } else {
+            printf("Error: Nieznana opcja %s\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
     FILE* TransportStreamFile = fopen("example_new.ts", "rb");
     FILE* AudioMP2 = fopen("PID136.mp2", "wb");
+    FILE* QuarantineFile = QuarantinePath ? fopen(QuarantinePath, "wb") : nullptr;
+    FILE* PassthroughFile = PassthroughPath ? fopen(PassthroughPath, "wb") : nullptr;
 
     if (TransportStreamFile == NULL) {
         printf("Error: Nie można otworzyć pliku strumienia transportowego\n");
@@ -20,17 +165,38 @@ int main(int argc, char *argv[ ], char *envp[ ]) {
         return EXIT_FAILURE;
     }
 
+    if ((QuarantinePath && QuarantineFile == NULL) || (PassthroughPath && PassthroughFile == NULL)) {
+        printf("Error: Nie można utworzyć pliku kwarantanny lub przekazywania\n");
+        fclose(TransportStreamFile);
+        fclose(AudioMP2);
+        if (QuarantineFile) { fclose(QuarantineFile); }
+        if (PassthroughFile) { fclose(PassthroughFile); }
+        return EXIT_FAILURE;
+    }
+
+    xTS_PacketPolicy PacketPolicy;
+    PacketPolicy.Init(xTS_PacketPolicy::eAction::Quarantine, xTS_PacketPolicy::eAction::Quarantine, QuarantineFile);
+    PacketPolicy.setPassthroughSink(PassthroughFile);
+    for (uint16_t PID : PassthroughPIDs) {
+        PacketPolicy.addPassthroughPID(PID);
+    }
+
     uint8_t TS_PacketBuffer[xTS::TS_PacketLength];
     xTS_PacketHeader TS_PacketHeader;
     xTS_AdaptationField TS_AdaptationField;
 
     xPES_Assembler PES_Assembler136;
-    PES_Assembler136.Init(PID_AUDIO_MP2);
+    PES_Assembler136.Init(xTS_PipelineDispatcher::PID_AUDIO_MP2);
+
+    xPSI_Assembler PSI_Assemblers[NumPSI_PIDs];
+    for (uint32_t i = 0; i < NumPSI_PIDs; i++) {
+        PSI_Assemblers[i].Init((int32_t)PSI_PIDs[i]);
+    }
 
     int32_t TS_PacketId = 0;
     const int32_t max_packets_to_parse = 10000;
 
-    printf("Rozpoczynanie parsowania MPEG-TS dla PID %u...\n", PID_AUDIO_MP2);
+    printf("Rozpoczynanie parsowania MPEG-TS dla PID %u...\n", xTS_PipelineDispatcher::PID_AUDIO_MP2);
     printf("Przetwarzanie do %d pakietów...\n\n", max_packets_to_parse);
 
     while (true) {
@@ -53,7 +219,13 @@ int main(int argc, char *argv[ ], char *envp[ ]) {
         TS_PacketHeader.Reset();
         TS_PacketHeader.Parse(TS_PacketBuffer);
 
-        if (TS_PacketHeader.getSyncByte() == 0x47 && TS_PacketHeader.getPID() == PID_AUDIO_MP2) {
+        bool IsSynced = TS_PacketHeader.getSyncByte() == 0x47;
+
+        if (IsSynced && PacketPolicy.Check(TS_PacketBuffer, &TS_PacketHeader) != xTS_PacketPolicy::eVerdict::Accept) {
+            if (TS_PacketHeader.getPID() == xTS_PipelineDispatcher::PID_AUDIO_MP2) {
+                printf("Pakiet TS %010d: pominięty (E=%d TSC=%d)\n", TS_PacketId, TS_PacketHeader.getEByte(), TS_PacketHeader.getTSC());
+            }
+        } else if (IsSynced && TS_PacketHeader.getPID() == xTS_PipelineDispatcher::PID_AUDIO_MP2) {
             TS_AdaptationField.Reset();
 
             if (TS_PacketHeader.hasAdaptationField()) {
@@ -68,6 +240,20 @@ int main(int argc, char *argv[ ], char *envp[ ]) {
             }
 
             PES_Assembler136.assemblerPes(TS_PacketBuffer, &TS_PacketHeader, &TS_AdaptationField, AudioMP2);
+        } else if (IsSynced) {
+            for (uint32_t i = 0; i < NumPSI_PIDs; i++) {
+                if (TS_PacketHeader.getPID() != (uint16_t)PSI_PIDs[i]) {
+                    continue;
+                }
+                TS_AdaptationField.Reset();
+                if (TS_PacketHeader.hasAdaptationField()) {
+                    TS_AdaptationField.Parse(TS_PacketBuffer, TS_PacketHeader.getAFC());
+                }
+                if (PSI_Assemblers[i].AbsorbPacket(TS_PacketBuffer, &TS_PacketHeader, &TS_AdaptationField) == xPSI_Assembler::eResult::SectionCRCError) {
+                    printf("Pakiet TS %010d: błąd CRC sekcji PSI dla PID %d\n", TS_PacketId, PSI_Assemblers[i].getPID());
+                }
+                break;
+            }
         }
 
         TS_PacketId++;
@@ -75,8 +261,17 @@ int main(int argc, char *argv[ ], char *envp[ ]) {
 
     fclose(TransportStreamFile);
     fclose(AudioMP2);
+    if (QuarantineFile) { fclose(QuarantineFile); }
+    if (PassthroughFile) { fclose(PassthroughFile); }
 
     printf("\nParsowanie zakończone. Dane audio zapisane.\n");
+    printf("Weryfikacja CRC (kernel CRC32: %s):\n", xCRC32::getKernelName());
+    printf("  PES PID %u: błędy CRC=%u\n", xTS_PipelineDispatcher::PID_AUDIO_MP2, PES_Assembler136.getNumPESCRCErrors());
+    for (uint32_t i = 0; i < NumPSI_PIDs; i++) {
+        printf("  PSI PID %d: poprawne=%u błędy CRC=%u utracone=%u\n", PSI_Assemblers[i].getPID(),
+               PSI_Assemblers[i].getNumValid(), PSI_Assemblers[i].getNumCRCErrors(), PSI_Assemblers[i].getNumLost());
+    }
+    PacketPolicy.Print();
 
     return EXIT_SUCCESS;
 }
\ No newline at end of file
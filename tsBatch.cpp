@@ -0,0 +1,485 @@
+#include "tsBatch.h"
+#include "tsTransportStream.h"
+#include "tsPacketPolicy.h"
+#include "tsPipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static int64_t xNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static int xSeek(FILE* File, uint64_t Offset)
+{
+#if defined(_MSC_VER)
+    return _fseeki64(File, (int64_t)Offset, SEEK_SET);
+#else
+    return fseeko(File, (off_t)Offset, SEEK_SET);
+#endif
+}
+
+//=============================================================================================================================================================================
+// xBatchStats
+//=============================================================================================================================================================================
+void xBatchStats::Add(const xBatchStats& Stats)
+{
+    NumPackets += Stats.NumPackets;
+    NumPES += Stats.NumPES;
+    NumOutputBytes += Stats.NumOutputBytes;
+    NumPacketsLost += Stats.NumPacketsLost;
+    NumOverflows += Stats.NumOverflows;
+    NumEvictions += Stats.NumEvictions;
+    NumSyncErrors += Stats.NumSyncErrors;
+    NumPESCRCErrors += Stats.NumPESCRCErrors;
+    NumTransportErrors += Stats.NumTransportErrors;
+    NumScrambled += Stats.NumScrambled;
+}
+
+//=============================================================================================================================================================================
+// xBatchScheduler
+//=============================================================================================================================================================================
+xBatchScheduler::xBatchScheduler(const xBatchConfig& Config) : m_Config(Config), m_Governor(Config.Memory),
+                                                               m_NumOutstandingTasks(0), m_NumIdleWorkers(0),
+                                                               m_NumSplits(0),
+                                                               m_AssemblerPool(xPES_Assembler::BufferCapacity),
+                                                               m_ReadPool(ReadBlockPackets * xTS::TS_PacketLength),
+                                                               m_Seconds(0)
+{
+    if (m_Config.NumThreads == 0)
+    {
+        m_Config.NumThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+bool xBatchScheduler::xMatchWildcard(const char* Pattern, const char* Name)
+{
+    const char* starPattern = nullptr;
+    const char* starName = nullptr;
+    while (*Name)
+    {
+        if (*Pattern == '*')
+        {
+            starPattern = Pattern++;
+            starName = Name;
+        }
+        else if (*Pattern == '?' || *Pattern == *Name)
+        {
+            Pattern++;
+            Name++;
+        }
+        else if (starPattern)
+        {
+            Pattern = starPattern + 1;
+            Name = ++starName;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (*Pattern == '*')
+    {
+        Pattern++;
+    }
+    return *Pattern == 0;
+}
+
+int32_t xBatchScheduler::CollectFiles()
+{
+    std::error_code error;
+    fs::path input(m_Config.Input);
+    std::vector<fs::path> paths;
+
+    if (fs::is_directory(input, error))
+    {
+        for (const fs::directory_entry& entry : fs::directory_iterator(input, error))
+        {
+            if (entry.is_regular_file(error) && entry.path().extension() == ".ts")
+            {
+                paths.push_back(entry.path());
+            }
+        }
+    }
+    else if (input.filename().string().find_first_of("*?") != std::string::npos)
+    {
+        fs::path directory = input.has_parent_path() ? input.parent_path() : fs::path(".");
+        std::string pattern = input.filename().string();
+        if (!fs::is_directory(directory, error))
+        {
+            return NOT_VALID;
+        }
+        for (const fs::directory_entry& entry : fs::directory_iterator(directory, error))
+        {
+            if (entry.is_regular_file(error) && xMatchWildcard(pattern.c_str(), entry.path().filename().string().c_str()))
+            {
+                paths.push_back(entry.path());
+            }
+        }
+    }
+    else if (fs::is_regular_file(input, error))
+    {
+        paths.push_back(input);
+    }
+    else
+    {
+        return NOT_VALID;
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    m_Files.clear();
+    for (const fs::path& path : paths)
+    {
+        std::unique_ptr<xFile> file = std::make_unique<xFile>();
+        file->InputPath = path.string();
+        file->OutputPath = (path.parent_path() / (path.stem().string() + "_PID" + std::to_string(m_Config.PID) + ".mp2")).string();
+        file->Size = fs::file_size(path, error);
+        if (error)
+        {
+            file->Size = 0;
+            file->Failed = true;
+        }
+        m_Files.push_back(std::move(file));
+    }
+    return (int32_t)m_Files.size();
+}
+
+void xBatchScheduler::Run()
+{
+    int64_t startTime = xNowNs();
+
+    m_Queues.clear();
+    for (uint32_t i = 0; i < m_Config.NumThreads; i++)
+    {
+        m_Queues.push_back(std::make_unique<xWorkerQueue>());
+    }
+
+    // largest files first, dealt round-robin - owners pop from the back, so each worker starts with its smallest file
+    std::vector<uint32_t> order(m_Files.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+    {
+        return m_Files[a]->Size > m_Files[b]->Size;
+    });
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        xFile& file = *m_Files[order[i]];
+        file.NumPendingTasks = 1;
+        uint64_t end = file.Size - file.Size % xTS::TS_PacketLength;
+        xPushTask(i % m_Config.NumThreads, xTask{order[i], 0, end});
+    }
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < m_Config.NumThreads; i++)
+    {
+        workers.emplace_back(&xBatchScheduler::xWorker, this, i);
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    m_Seconds = (xNowNs() - startTime) / 1e9;
+}
+
+void xBatchScheduler::xWorker(uint32_t WorkerIndex)
+{
+    bool idle = false;
+    xTask task;
+    while (true)
+    {
+        if (xPopTask(WorkerIndex, task))
+        {
+            if (idle)
+            {
+                m_NumIdleWorkers--;
+                idle = false;
+            }
+            xProcessTask(WorkerIndex, task);
+            m_NumOutstandingTasks--;
+            continue;
+        }
+        if (m_NumOutstandingTasks.load() == 0)
+        {
+            break;
+        }
+        if (!idle)
+        {
+            m_NumIdleWorkers++;
+            idle = true;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    if (idle)
+    {
+        m_NumIdleWorkers--;
+    }
+}
+
+bool xBatchScheduler::xPopTask(uint32_t WorkerIndex, xTask& Task)
+{
+    {
+        xWorkerQueue& own = *m_Queues[WorkerIndex];
+        std::lock_guard<std::mutex> lock(own.Mutex);
+        if (!own.Tasks.empty())
+        {
+            Task = own.Tasks.back();
+            own.Tasks.pop_back();
+            return true;
+        }
+    }
+    for (uint32_t i = 1; i < m_Queues.size(); i++)
+    {
+        xWorkerQueue& victim = *m_Queues[(WorkerIndex + i) % m_Queues.size()];
+        std::lock_guard<std::mutex> lock(victim.Mutex);
+        if (!victim.Tasks.empty())
+        {
+            Task = victim.Tasks.front();
+            victim.Tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void xBatchScheduler::xPushTask(uint32_t WorkerIndex, const xTask& Task)
+{
+    m_NumOutstandingTasks++;
+    xWorkerQueue& queue = *m_Queues[WorkerIndex];
+    std::lock_guard<std::mutex> lock(queue.Mutex);
+    queue.Tasks.push_back(Task);
+}
+
+template <class tPipeline>
+void xBatchScheduler::xProcessRange(uint32_t WorkerIndex, xTask& Task, FILE* Input, tPipeline& Pipeline,
+                                    xTS_PacketPolicy& PacketPolicy, xBatchStats& Stats)
+{
+    xFile& file = *m_Files[Task.FileIndex];
+    xTS_PacketHeader packetHeader;
+
+    uint8_t* block = m_ReadPool.Acquire();
+    uint32_t numBlockPackets = 0;
+    uint32_t blockIndex = 0;
+    uint32_t sinceSplitCheck = 0;
+    uint64_t position = Task.Begin;
+
+    while (true)
+    {
+        if (blockIndex == numBlockPackets)
+        {
+            size_t numRead = fread(block, 1, m_ReadPool.getBufferSize(), Input);
+            numBlockPackets = (uint32_t)(numRead / xTS::TS_PacketLength);
+            blockIndex = 0;
+            if (numBlockPackets == 0)
+            {
+                break;
+            }
+        }
+        const uint8_t* packet = block + blockIndex * xTS::TS_PacketLength;
+
+        packetHeader.Parse(packet);
+        bool isSynced = packetHeader.getSyncByte() == 0x47;
+        bool isAccepted = false;
+
+        if (position >= Task.End)
+        {
+            // past the range only the PES in progress is completed, the next PES belongs to the following range;
+            // these packets are counted (and their policy applied) by the following range
+            isAccepted = isSynced && xTS_PacketPolicy::isClean(packetHeader);
+            if (!Pipeline.isAssembling() ||
+                (isAccepted && packetHeader.getPID() == Pipeline.getPID() && packetHeader.getPayloadUnitStartIndicator()))
+            {
+                break;
+            }
+        }
+        else
+        {
+            Stats.NumPackets++;
+            if (!isSynced)
+            {
+                Stats.NumSyncErrors++;
+            }
+            else
+            {
+                isAccepted = PacketPolicy.Check(packet, &packetHeader) == xTS_PacketPolicy::eVerdict::Accept;
+            }
+        }
+        blockIndex++;
+        position += xTS::TS_PacketLength;
+
+        if (isAccepted)
+        {
+            Pipeline.Process(packet, packetHeader, (int32_t)(position / xTS::TS_PacketLength) - 1);
+        }
+
+        if (++sinceSplitCheck == SplitCheckPackets)
+        {
+            sinceSplitCheck = 0;
+            if (m_NumIdleWorkers.load() > 0 && position < Task.End &&
+                Task.End - position >= 2 * std::max<uint64_t>(m_Config.MinSplitBytes, m_ReadPool.getBufferSize()))
+            {
+                uint64_t middle = position + (Task.End - position) / 2 / xTS::TS_PacketLength * xTS::TS_PacketLength;
+                file.NumPendingTasks++;
+                xPushTask(WorkerIndex, xTask{Task.FileIndex, middle, Task.End});
+                m_NumSplits++;
+                Task.End = middle;
+            }
+        }
+    }
+    m_ReadPool.Release(block);
+
+    const xPipelineStats& pipelineStats = Pipeline.getStats();
+    Stats.NumPES = pipelineStats.NumPES;
+    Stats.NumPacketsLost = pipelineStats.NumPacketsLost;
+    Stats.NumOverflows = pipelineStats.NumOverflows;
+    Stats.NumEvictions = pipelineStats.NumEvictions;
+    Stats.NumPESCRCErrors = pipelineStats.NumPESCRCErrors;
+}
+
+void xBatchScheduler::xProcessTask(uint32_t WorkerIndex, xTask Task)
+{
+    xFile& file = *m_Files[Task.FileIndex];
+    int64_t notStarted = -1;
+    file.StartTime.compare_exchange_strong(notStarted, xNowNs());
+
+    xSegment segment;
+    segment.Begin = Task.Begin;
+    segment.Queue = std::make_unique<xSpillQueue>();
+    segment.Queue->Init(&m_Governor, m_Config.PID);
+    xBatchStats stats;
+    bool failed = false;
+
+    bool isFileFailed;
+    {
+        std::lock_guard<std::mutex> lock(file.Mutex);
+        isFileFailed = file.Failed;
+    }
+    FILE* input = isFileFailed ? nullptr : fopen(file.InputPath.c_str(), "rb");
+    if (input == NULL || xSeek(input, Task.Begin) != 0)
+    {
+        failed = true;
+    }
+    else
+    {
+        xTS_PacketPolicy packetPolicy;
+        packetPolicy.Init();
+
+        // the common MP2 job gets the instantiation with the PID folded in at compile time
+        if (m_Config.PID == xTS_PipelineDispatcher::PID_AUDIO_MP2)
+        {
+            xTS_Pipeline<xPidFilter_Fixed<xTS_PipelineDispatcher::PID_AUDIO_MP2>, xAF_LengthOnly, xPES_Quiet, xSink_Queue>
+                pipeline(xPidFilter_Fixed<xTS_PipelineDispatcher::PID_AUDIO_MP2>(), xSink_Queue(segment.Queue.get()),
+                         &packetPolicy, &m_AssemblerPool, &m_Governor);
+            xProcessRange(WorkerIndex, Task, input, pipeline, packetPolicy, stats);
+        }
+        else
+        {
+            xTS_Pipeline<xPidFilter_Runtime, xAF_LengthOnly, xPES_Quiet, xSink_Queue>
+                pipeline(xPidFilter_Runtime(m_Config.PID), xSink_Queue(segment.Queue.get()), &packetPolicy,
+                         &m_AssemblerPool, &m_Governor);
+            xProcessRange(WorkerIndex, Task, input, pipeline, packetPolicy, stats);
+        }
+        stats.NumTransportErrors = packetPolicy.getNumTransportErrors();
+        stats.NumScrambled = packetPolicy.getNumScrambled();
+    }
+    if (input)
+    {
+        fclose(input);
+    }
+
+    stats.NumOutputBytes = segment.Queue->getNumBytes();
+    {
+        std::lock_guard<std::mutex> lock(file.Mutex);
+        file.Stats.Add(stats);
+        file.Failed |= failed;
+        file.Segments.push_back(std::move(segment));
+    }
+    if (file.NumPendingTasks.fetch_sub(1) == 1)
+    {
+        xFinalizeFile(file);
+    }
+}
+
+void xBatchScheduler::xFinalizeFile(xFile& File)
+{
+    std::sort(File.Segments.begin(), File.Segments.end(), [](const xSegment& a, const xSegment& b)
+    {
+        return a.Begin < b.Begin;
+    });
+
+    if (!File.Failed)
+    {
+        FILE* output = fopen(File.OutputPath.c_str(), "wb");
+        if (output == NULL)
+        {
+            File.Failed = true;
+        }
+        else
+        {
+            for (const xSegment& segment : File.Segments)
+            {
+                File.Failed |= !segment.Queue->CopyTo(output);
+            }
+            fclose(output);
+        }
+    }
+
+    // keep the segment count for the report, drop the data and its governor charge
+    for (xSegment& segment : File.Segments)
+    {
+        segment.Queue->Clear();
+    }
+    File.Seconds = (xNowNs() - File.StartTime.load()) / 1e9;
+}
+
+void xBatchScheduler::PrintReport(FILE* Output) const
+{
+    xBatchStats total;
+    uint64_t totalBytes = 0;
+    uint32_t numFailed = 0;
+
+    fprintf(Output, "Batch summary: PID=%u files=%u threads=%u splits=%u\n", m_Config.PID, (uint32_t)m_Files.size(),
+            m_Config.NumThreads, m_NumSplits.load());
+    fprintf(Output, "%-40s %12s %10s %12s %6s %6s %6s %6s %6s %8s %8s %4s %8s\n", "file", "packets", "PES", "output",
+            "lost", "ovfl", "evict", "sync", "crc", "tei", "scr", "seg", "time[s]");
+    for (const std::unique_ptr<xFile>& file : m_Files)
+    {
+        const xBatchStats& stats = file->Stats;
+        fprintf(Output, "%-40s %12" PRIu64 " %10" PRIu64 " %12" PRIu64 " %6u %6u %6u %6u %6u %8" PRIu64 " %8" PRIu64
+                " %4u %8.3f%s\n", fs::path(file->InputPath).filename().string().c_str(), stats.NumPackets,
+                stats.NumPES, stats.NumOutputBytes, stats.NumPacketsLost, stats.NumOverflows, stats.NumEvictions,
+                stats.NumSyncErrors, stats.NumPESCRCErrors, stats.NumTransportErrors, stats.NumScrambled,
+                (uint32_t)file->Segments.size(), file->Seconds, file->Failed ? " FAILED" : "");
+        total.Add(stats);
+        totalBytes += file->Size;
+        numFailed += file->Failed ? 1 : 0;
+    }
+    fprintf(Output, "%-40s %12" PRIu64 " %10" PRIu64 " %12" PRIu64 " %6u %6u %6u %6u %6u %8" PRIu64 " %8" PRIu64 "\n",
+            "TOTAL", total.NumPackets, total.NumPES, total.NumOutputBytes, total.NumPacketsLost, total.NumOverflows,
+            total.NumEvictions, total.NumSyncErrors, total.NumPESCRCErrors, total.NumTransportErrors, total.NumScrambled);
+    fprintf(Output, "Failed files: %u, input: %" PRIu64 " bytes in %.3f s (%.1f MB/s), buffers: %u assembler / %u read\n",
+            numFailed, totalBytes, m_Seconds, m_Seconds > 0 ? totalBytes / m_Seconds / 1e6 : 0.0,
+            m_AssemblerPool.getNumAllocated(), m_ReadPool.getNumAllocated());
+    m_Governor.Print(Output);
+}
+
+bool xBatchScheduler::WriteReport() const
+{
+    FILE* report = fopen(m_Config.ReportPath.c_str(), "w");
+    if (report == NULL)
+    {
+        return false;
+    }
+    PrintReport(report);
+    fclose(report);
+    return true;
+}
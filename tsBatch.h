@@ -0,0 +1,136 @@
+//tsBatch.h
+
+#pragma once
+#include "tsCommon.h"
+#include "tsBufferPool.h"
+#include "tsMemoryGovernor.h"
+#include "tsPacketPolicy.h"
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+Batch mode:
+Every input file is a task covering byte range [0, FileSize). Each worker owns a deque - it pops its own tasks from the
+back and steals from the front of other workers' deques. When some workers are idle and nothing is left to steal,
+a worker running a large range gives away the second half of it as a new task (split).
+
+Range [Begin, End) of a file:
+- packets before the first PUSI of the PID belong to the previous range and are ignored (assembler is not started),
+- the PES in progress at End is completed by reading past End, the first PUSI at or after End stops the range.
+Output of all ranges of a file is concatenated in Begin order, so split and unsplit runs produce identical files.
+Until then it is held in per-range queues charged to the memory governor, which spills them to disk under pressure.
+*/
+
+//=============================================================================================================================================================================
+
+struct xBatchConfig {
+    std::string Input;            //directory, glob (* and ? in file name) or single file
+    uint32_t NumThreads = 0;      //0 - hardware concurrency
+    uint16_t PID = 136;
+    std::string ReportPath = "batch_summary.txt";
+    uint64_t MinSplitBytes = 8 << 20; //ranges shorter than 2x this are never split
+    xMemoryGovernor::xConfig Memory;  //caps for pending PES and queued output, shared by all workers
+};
+
+//=============================================================================================================================================================================
+
+struct xBatchStats {
+    uint64_t NumPackets = 0;
+    uint64_t NumPES = 0;
+    uint64_t NumOutputBytes = 0;
+    uint32_t NumPacketsLost = 0;
+    uint32_t NumOverflows = 0;
+    uint32_t NumEvictions = 0;
+    uint32_t NumSyncErrors = 0;
+    uint32_t NumPESCRCErrors = 0;
+    uint64_t NumTransportErrors = 0;
+    uint64_t NumScrambled = 0;
+
+    void Add(const xBatchStats &Stats);
+};
+
+//=============================================================================================================================================================================
+
+class xBatchScheduler {
+public:
+    static constexpr uint32_t ReadBlockPackets = 2048;
+    static constexpr uint32_t SplitCheckPackets = 4096;
+
+protected:
+    struct xTask {
+        uint32_t FileIndex;
+        uint64_t Begin;
+        uint64_t End;
+    };
+
+    struct xSegment {
+        uint64_t Begin;
+        std::unique_ptr<xSpillQueue> Queue;
+    };
+
+    struct xFile {
+        std::string InputPath;
+        std::string OutputPath;
+        uint64_t Size = 0;
+        std::mutex Mutex;
+        std::vector<xSegment> Segments;
+        std::atomic<uint32_t> NumPendingTasks{0};
+        xBatchStats Stats;
+        bool Failed = false;
+        double Seconds = 0;
+        std::atomic<int64_t> StartTime{-1};
+    };
+
+    struct xWorkerQueue {
+        std::mutex Mutex;
+        std::deque<xTask> Tasks;
+    };
+
+protected:
+    xBatchConfig m_Config;
+    xMemoryGovernor m_Governor; //declared before m_Files - segment queues detach from it when destroyed
+    std::vector<std::unique_ptr<xFile>> m_Files;
+    std::vector<std::unique_ptr<xWorkerQueue>> m_Queues;
+    std::atomic<uint64_t> m_NumOutstandingTasks;
+    std::atomic<uint32_t> m_NumIdleWorkers;
+    std::atomic<uint32_t> m_NumSplits;
+    xBufferPool m_AssemblerPool;
+    xBufferPool m_ReadPool;
+    double m_Seconds;
+
+public:
+    explicit xBatchScheduler(const xBatchConfig &Config);
+
+    //returns number of input files or NOT_VALID when Input does not exist
+    int32_t CollectFiles();
+
+    void Run();
+
+    void PrintReport(FILE *Output) const;
+    bool WriteReport() const;
+
+    uint32_t getNumFiles() const { return (uint32_t)m_Files.size(); }
+    uint32_t getNumThreads() const { return m_Config.NumThreads; }
+
+protected:
+    void xWorker(uint32_t WorkerIndex);
+
+    bool xPopTask(uint32_t WorkerIndex, xTask &Task);
+
+    void xPushTask(uint32_t WorkerIndex, const xTask &Task);
+
+    void xProcessTask(uint32_t WorkerIndex, xTask Task);
+
+    template <class tPipeline>
+    void xProcessRange(uint32_t WorkerIndex, xTask &Task, FILE *Input, tPipeline &Pipeline,
+                       xTS_PacketPolicy &PacketPolicy, xBatchStats &Stats);
+
+    void xFinalizeFile(xFile &File);
+
+    static bool xMatchWildcard(const char *Pattern, const char *Name);
+};
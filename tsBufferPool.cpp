@@ -0,0 +1,42 @@
+#include "tsBufferPool.h"
+
+//=============================================================================================================================================================================
+// xBufferPool
+//=============================================================================================================================================================================
+xBufferPool::xBufferPool(uint32_t BufferSize) : m_BufferSize(BufferSize), m_NumAllocated(0)
+{
+}
+
+xBufferPool::~xBufferPool()
+{
+    for (uint8_t* Buffer : m_Free)
+    {
+        delete[] Buffer;
+    }
+    m_Free.clear();
+}
+
+uint8_t* xBufferPool::Acquire()
+{
+    {
+        std::lock_guard<std::mutex> Lock(m_Mutex);
+        if (!m_Free.empty())
+        {
+            uint8_t* Buffer = m_Free.back();
+            m_Free.pop_back();
+            return Buffer;
+        }
+        m_NumAllocated++;
+    }
+    return new uint8_t[m_BufferSize];
+}
+
+void xBufferPool::Release(uint8_t* Buffer)
+{
+    if (!Buffer)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> Lock(m_Mutex);
+    m_Free.push_back(Buffer);
+}
@@ -0,0 +1,32 @@
+//tsBufferPool.h
+
+#pragma once
+#include "tsCommon.h"
+#include <mutex>
+#include <vector>
+
+//=============================================================================================================================================================================
+
+// Thread-safe free list of fixed size buffers, shared between assemblers and readers of all batch workers
+class xBufferPool {
+protected:
+    uint32_t m_BufferSize;
+    std::mutex m_Mutex;
+    std::vector<uint8_t *> m_Free;
+    uint32_t m_NumAllocated;
+
+public:
+    explicit xBufferPool(uint32_t BufferSize);
+
+    ~xBufferPool();
+
+    xBufferPool(const xBufferPool &) = delete;
+    xBufferPool &operator=(const xBufferPool &) = delete;
+
+    uint8_t *Acquire();
+
+    void Release(uint8_t *Buffer);
+
+    uint32_t getBufferSize() const { return m_BufferSize; }
+    uint32_t getNumAllocated() const { return m_NumAllocated; }
+};
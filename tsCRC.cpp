@@ -0,0 +1,296 @@
+#include "tsCRC.h"
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TS_CRC_PCLMULQDQ 1
+#define TS_CRC_TARGET_PCLMULQDQ __attribute__((target("pclmul,ssse3")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_AMD64))
+#define TS_CRC_PCLMULQDQ 1
+#define TS_CRC_TARGET_PCLMULQDQ
+#else
+#define TS_CRC_PCLMULQDQ 0
+#endif
+
+//=============================================================================================================================================================================
+// Tables & folding constants
+//=============================================================================================================================================================================
+namespace {
+
+struct xCRC32Tables {
+    uint32_t T[8][256];
+};
+
+constexpr xCRC32Tables xMakeCRC32Tables()
+{
+    xCRC32Tables Tables{};
+    for (uint32_t b = 0; b < 256; b++)
+    {
+        uint32_t crc = b << 24;
+        for (int32_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ xCRC32::Polynomial : (crc << 1);
+        }
+        Tables.T[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++)
+    {
+        for (int32_t k = 1; k < 8; k++)
+        {
+            uint32_t prev = Tables.T[k - 1][b];
+            Tables.T[k][b] = (prev << 8) ^ Tables.T[0][prev >> 24];
+        }
+    }
+    return Tables;
+}
+
+constexpr xCRC32Tables CRC32Tables = xMakeCRC32Tables();
+
+struct xCRC16Tables {
+    uint16_t T[8][256];
+};
+
+constexpr xCRC16Tables xMakeCRC16Tables()
+{
+    xCRC16Tables Tables{};
+    for (uint32_t b = 0; b < 256; b++)
+    {
+        uint16_t crc = (uint16_t)(b << 8);
+        for (int32_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ xCRC16::Polynomial) : (uint16_t)(crc << 1);
+        }
+        Tables.T[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++)
+    {
+        for (int32_t k = 1; k < 8; k++)
+        {
+            uint16_t prev = Tables.T[k - 1][b];
+            Tables.T[k][b] = (uint16_t)(prev << 8) ^ Tables.T[0][prev >> 8];
+        }
+    }
+    return Tables;
+}
+
+constexpr xCRC16Tables CRC16Tables = xMakeCRC16Tables();
+
+// x^N mod P (P of degree Degree) - used to fold 128-bit lanes forward by N-64 and N bits
+constexpr uint64_t xPowModP(uint32_t N, uint32_t Polynomial, uint32_t Degree)
+{
+    const uint64_t Top = 1ull << (Degree - 1);
+    const uint64_t Mask = (1ull << Degree) - 1;
+    uint64_t r = 1;
+    for (uint32_t i = 0; i < N; i++)
+    {
+        r = (r & Top) ? ((r << 1) ^ Polynomial) & Mask : (r << 1) & Mask;
+    }
+    return r;
+}
+
+constexpr uint64_t CRC32_Fold512_Hi = xPowModP(512 + 64, xCRC32::Polynomial, 32);
+constexpr uint64_t CRC32_Fold512_Lo = xPowModP(512, xCRC32::Polynomial, 32);
+constexpr uint64_t CRC32_Fold128_Hi = xPowModP(128 + 64, xCRC32::Polynomial, 32);
+constexpr uint64_t CRC32_Fold128_Lo = xPowModP(128, xCRC32::Polynomial, 32);
+
+constexpr uint64_t CRC16_Fold512_Hi = xPowModP(512 + 64, xCRC16::Polynomial, 16);
+constexpr uint64_t CRC16_Fold512_Lo = xPowModP(512, xCRC16::Polynomial, 16);
+constexpr uint64_t CRC16_Fold128_Hi = xPowModP(128 + 64, xCRC16::Polynomial, 16);
+constexpr uint64_t CRC16_Fold128_Lo = xPowModP(128, xCRC16::Polynomial, 16);
+
+} //namespace
+
+//=============================================================================================================================================================================
+// xCRC32
+//=============================================================================================================================================================================
+uint32_t xCRC32::CalcSlicingBy8(const uint8_t* Data, uint32_t Size, uint32_t CRC)
+{
+    const auto& T = CRC32Tables.T;
+
+    while (Size >= 8)
+    {
+        uint32_t hi;
+        memcpy(&hi, Data, sizeof(hi));
+        hi = xSwapBytes32(hi) ^ CRC;
+        CRC = T[7][hi >> 24] ^ T[6][(hi >> 16) & 0xFF] ^ T[5][(hi >> 8) & 0xFF] ^ T[4][hi & 0xFF] ^
+              T[3][Data[4]] ^ T[2][Data[5]] ^ T[1][Data[6]] ^ T[0][Data[7]];
+        Data += 8;
+        Size -= 8;
+    }
+    while (Size--)
+    {
+        CRC = (CRC << 8) ^ T[0][(CRC >> 24) ^ *Data++];
+    }
+    return CRC;
+}
+
+#if TS_CRC_PCLMULQDQ
+/*
+Non-reflected folding: every 16-byte block is byte-reversed so that the register holds the block as a 128-bit polynomial
+with the first transmitted bit as the highest coefficient. A lane X = H*x^64 + L is moved forward by N bits as
+H*(x^(N+64) mod P) + L*(x^N mod P). The same folding serves CRC-32 and CRC-16 (the constants are shorter than 64 bits
+either way); the final 128-bit remainder is reduced with the table kernel of the CRC.
+*/
+TS_CRC_TARGET_PCLMULQDQ static inline __m128i xFold(__m128i X, __m128i K)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(X, K, 0x11), _mm_clmulepi64_si128(X, K, 0x00));
+}
+
+//Size >= 64; folds all whole 16-byte blocks, returns the remainder (in transmission byte order) and advances Data/Size
+TS_CRC_TARGET_PCLMULQDQ static void xFoldBlocks(const uint8_t*& Data, uint32_t& Size, __m128i Initial, __m128i K512,
+                                                __m128i K128, uint8_t Remainder[16])
+{
+    const __m128i Reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    __m128i X0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 0)), Reverse);
+    __m128i X1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 16)), Reverse);
+    __m128i X2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 32)), Reverse);
+    __m128i X3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 48)), Reverse);
+    X0 = _mm_xor_si128(X0, Initial);
+    Data += 64;
+    Size -= 64;
+
+    while (Size >= 64)
+    {
+        X0 = _mm_xor_si128(xFold(X0, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 0)), Reverse));
+        X1 = _mm_xor_si128(xFold(X1, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 16)), Reverse));
+        X2 = _mm_xor_si128(xFold(X2, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 32)), Reverse));
+        X3 = _mm_xor_si128(xFold(X3, K512), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(Data + 48)), Reverse));
+        Data += 64;
+        Size -= 64;
+    }
+
+    __m128i X = _mm_xor_si128(xFold(X0, K128), X1);
+    X = _mm_xor_si128(xFold(X, K128), X2);
+    X = _mm_xor_si128(xFold(X, K128), X3);
+
+    while (Size >= 16)
+    {
+        X = _mm_xor_si128(xFold(X, K128), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)Data), Reverse));
+        Data += 16;
+        Size -= 16;
+    }
+
+    _mm_storeu_si128((__m128i*)Remainder, _mm_shuffle_epi8(X, Reverse));
+}
+
+TS_CRC_TARGET_PCLMULQDQ static uint32_t xCalcPCLMULQDQ(const uint8_t* Data, uint32_t Size, uint32_t CRC)
+{
+    if (Size < 64)
+    {
+        return xCRC32::CalcSlicingBy8(Data, Size, CRC);
+    }
+    uint8_t Remainder[16];
+    xFoldBlocks(Data, Size, _mm_set_epi32((int32_t)CRC, 0, 0, 0),
+                _mm_set_epi64x((int64_t)CRC32_Fold512_Hi, (int64_t)CRC32_Fold512_Lo),
+                _mm_set_epi64x((int64_t)CRC32_Fold128_Hi, (int64_t)CRC32_Fold128_Lo), Remainder);
+    CRC = xCRC32::CalcSlicingBy8(Remainder, sizeof(Remainder), 0);
+    return xCRC32::CalcSlicingBy8(Data, Size, CRC);
+}
+
+TS_CRC_TARGET_PCLMULQDQ static uint16_t xCalcPCLMULQDQ16(const uint8_t* Data, uint32_t Size, uint16_t CRC)
+{
+    if (Size < 64)
+    {
+        return xCRC16::CalcSlicingBy8(Data, Size, CRC);
+    }
+    uint8_t Remainder[16];
+    xFoldBlocks(Data, Size, _mm_set_epi32((int32_t)((uint32_t)CRC << 16), 0, 0, 0),
+                _mm_set_epi64x((int64_t)CRC16_Fold512_Hi, (int64_t)CRC16_Fold512_Lo),
+                _mm_set_epi64x((int64_t)CRC16_Fold128_Hi, (int64_t)CRC16_Fold128_Lo), Remainder);
+    CRC = xCRC16::CalcSlicingBy8(Remainder, sizeof(Remainder), 0);
+    return xCRC16::CalcSlicingBy8(Data, Size, CRC);
+}
+#endif
+
+uint32_t xCRC32::CalcPCLMULQDQ(const uint8_t* Data, uint32_t Size, uint32_t CRC)
+{
+#if TS_CRC_PCLMULQDQ
+    if (isPCLMULQDQSupported())
+    {
+        return xCalcPCLMULQDQ(Data, Size, CRC);
+    }
+#endif
+    return CalcSlicingBy8(Data, Size, CRC);
+}
+
+bool xCRC32::isPCLMULQDQSupported()
+{
+#if TS_CRC_PCLMULQDQ && defined(__GNUC__)
+    static const bool Supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+    return Supported;
+#elif TS_CRC_PCLMULQDQ && defined(_MSC_VER)
+    static const bool Supported = []()
+    {
+        int Info[4];
+        __cpuid(Info, 1);
+        return (Info[2] & (1 << 1)) && (Info[2] & (1 << 9)); //PCLMULQDQ, SSSE3
+    }();
+    return Supported;
+#else
+    return false;
+#endif
+}
+
+xCRC32::eKernel xCRC32::getKernel()
+{
+    return isPCLMULQDQSupported() ? eKernel::PCLMULQDQ : eKernel::SlicingBy8;
+}
+
+const char* xCRC32::getKernelName()
+{
+    return getKernel() == eKernel::PCLMULQDQ ? "PCLMULQDQ" : "slicing-by-8";
+}
+
+uint32_t xCRC32::Calc(const uint8_t* Data, uint32_t Size, uint32_t CRC)
+{
+#if TS_CRC_PCLMULQDQ
+    static uint32_t (* const Kernel)(const uint8_t*, uint32_t, uint32_t) =
+        isPCLMULQDQSupported() ? xCalcPCLMULQDQ : CalcSlicingBy8;
+    return Kernel(Data, Size, CRC);
+#else
+    return CalcSlicingBy8(Data, Size, CRC);
+#endif
+}
+
+//=============================================================================================================================================================================
+// xCRC16
+//=============================================================================================================================================================================
+uint16_t xCRC16::CalcSlicingBy8(const uint8_t* Data, uint32_t Size, uint16_t CRC)
+{
+    const auto& T = CRC16Tables.T;
+
+    while (Size >= 8)
+    {
+        CRC = T[7][Data[0] ^ (CRC >> 8)] ^ T[6][Data[1] ^ (CRC & 0xFF)] ^ T[5][Data[2]] ^ T[4][Data[3]] ^
+              T[3][Data[4]] ^ T[2][Data[5]] ^ T[1][Data[6]] ^ T[0][Data[7]];
+        Data += 8;
+        Size -= 8;
+    }
+    while (Size--)
+    {
+        CRC = (uint16_t)(CRC << 8) ^ T[0][(CRC >> 8) ^ *Data++];
+    }
+    return CRC;
+}
+
+uint16_t xCRC16::CalcPCLMULQDQ(const uint8_t* Data, uint32_t Size, uint16_t CRC)
+{
+#if TS_CRC_PCLMULQDQ
+    if (xCRC32::isPCLMULQDQSupported())
+    {
+        return xCalcPCLMULQDQ16(Data, Size, CRC);
+    }
+#endif
+    return CalcSlicingBy8(Data, Size, CRC);
+}
+
+uint16_t xCRC16::Calc(const uint8_t* Data, uint32_t Size, uint16_t CRC)
+{
+#if TS_CRC_PCLMULQDQ
+    static uint16_t (* const Kernel)(const uint8_t*, uint32_t, uint16_t) =
+        xCRC32::isPCLMULQDQSupported() ? xCalcPCLMULQDQ16 : CalcSlicingBy8;
+    return Kernel(Data, Size, CRC);
+#else
+    return CalcSlicingBy8(Data, Size, CRC);
+#endif
+}
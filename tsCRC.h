@@ -0,0 +1,61 @@
+//tsCRC.h
+
+#pragma once
+#include "tsCommon.h"
+
+/*
+CRC-32/MPEG-2 (ISO/IEC 13818-1 Annex A):
+Polynomial    : 0x04C11DB7 (x^32 + x^26 + x^23 + x^22 + x^16 + x^12 + x^11 + x^10 + x^8 + x^7 + x^5 + x^4 + x^2 + x + 1)
+Initial value : 0xFFFFFFFF
+Reflected     : no
+Final XOR     : none
+A section whose CRC_32 field is included in the calculation yields 0.
+
+CRC-16 of previous_PES_packet_CRC (ISO/IEC 13818-1 2.4.3.7):
+Polynomial    : 0x1021 (x^16 + x^12 + x^5 + 1)
+Initial value : 0xFFFF
+Reflected     : no
+Final XOR     : none
+*/
+
+//=============================================================================================================================================================================
+
+class xCRC32 {
+public:
+    static constexpr uint32_t Polynomial = 0x04C11DB7;
+    static constexpr uint32_t InitialValue = 0xFFFFFFFF;
+
+    enum class eKernel : int32_t {
+        SlicingBy8,
+        PCLMULQDQ,
+    };
+
+public:
+    //kernel selected at runtime (first call) based on CPU features
+    static uint32_t Calc(const uint8_t *Data, uint32_t Size, uint32_t CRC = InitialValue);
+    static uint32_t CalcSlicingBy8(const uint8_t *Data, uint32_t Size, uint32_t CRC = InitialValue);
+    static uint32_t CalcPCLMULQDQ(const uint8_t *Data, uint32_t Size, uint32_t CRC = InitialValue);
+
+    static eKernel getKernel();
+    static const char *getKernelName();
+    static bool isPCLMULQDQSupported();
+
+    //Section must span from table_id up to and including CRC_32 field
+    static bool CheckSection(const uint8_t *Section, uint32_t SectionSize) {
+        return SectionSize >= 4 && Calc(Section, SectionSize) == 0;
+    }
+};
+
+//=============================================================================================================================================================================
+
+class xCRC16 {
+public:
+    static constexpr uint16_t Polynomial = 0x1021;
+    static constexpr uint16_t InitialValue = 0xFFFF;
+
+public:
+    //kernel selected at runtime (first call), same CPU check as xCRC32
+    static uint16_t Calc(const uint8_t *Data, uint32_t Size, uint16_t CRC = InitialValue);
+    static uint16_t CalcSlicingBy8(const uint8_t *Data, uint32_t Size, uint16_t CRC = InitialValue);
+    static uint16_t CalcPCLMULQDQ(const uint8_t *Data, uint32_t Size, uint16_t CRC = InitialValue);
+};
@@ -0,0 +1,348 @@
+#include "tsMemoryGovernor.h"
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+//=============================================================================================================================================================================
+// xMemoryAccount
+//=============================================================================================================================================================================
+xMemoryAccount::xMemoryAccount() : m_Governor(nullptr), m_Queue(nullptr), m_PID(0), m_Kind(eKind::Assembler), m_Bytes(0),
+                                   m_ShedRequested(false)
+{
+}
+
+xMemoryAccount::~xMemoryAccount()
+{
+    Detach();
+}
+
+void xMemoryAccount::Attach(xMemoryGovernor* Governor, uint16_t PID, eKind Kind, xSpillQueue* Queue)
+{
+    Detach();
+    m_PID = PID & (xMemoryGovernor::NumPIDs - 1);
+    m_Kind = Kind;
+    m_Queue = Queue;
+    m_ShedRequested = false;
+    m_Governor = Governor;
+    if (m_Governor)
+    {
+        m_Governor->xRegister(this);
+    }
+}
+
+void xMemoryAccount::Detach()
+{
+    if (!m_Governor)
+    {
+        return;
+    }
+    ReleaseAll();
+    m_Governor->xUnregister(this);
+    m_Governor = nullptr;
+}
+
+bool xMemoryAccount::xCharge(uint64_t Bytes, bool Force)
+{
+    const xMemoryGovernor::xConfig& config = m_Governor->m_Config;
+    xMemoryGovernor::xPidUsage& usage = m_Governor->m_Usage[m_PID];
+    bool isAssembler = m_Kind == eKind::Assembler;
+    std::atomic<uint64_t>& pidBytes = isAssembler ? usage.AssemblerBytes : usage.QueueBytes;
+
+    if (!Force)
+    {
+        // the assembler cap is per stream, so one file's stream cannot starve another file's stream of the same PID
+        bool overCap = isAssembler ? config.AssemblerCap && m_Bytes.load() + Bytes > config.AssemblerCap
+                                   : config.QueueCapPerPID && pidBytes.load() + Bytes > config.QueueCapPerPID;
+        if (overCap || !m_Governor->xMakeRoom(this, Bytes))
+        {
+            m_ShedRequested = false;
+            (isAssembler ? usage.NumEvictions : usage.NumSpills)++;
+            return false;
+        }
+    }
+
+    m_Bytes += Bytes;
+    xMemoryGovernor::xUpdatePeak(isAssembler ? usage.AssemblerPeak : usage.QueuePeak, pidBytes += Bytes);
+    xMemoryGovernor::xUpdatePeak(m_Governor->m_PeakTotalBytes, m_Governor->m_TotalBytes += Bytes);
+    return true;
+}
+
+void xMemoryAccount::xRelease(uint64_t Bytes)
+{
+    xMemoryGovernor::xPidUsage& usage = m_Governor->m_Usage[m_PID];
+    m_Bytes -= Bytes;
+    (m_Kind == eKind::Assembler ? usage.AssemblerBytes : usage.QueueBytes) -= Bytes;
+    m_Governor->m_TotalBytes -= Bytes;
+}
+
+bool xMemoryAccount::xTakeShedRequest()
+{
+    if (!m_ShedRequested.exchange(false))
+    {
+        return false;
+    }
+    xMemoryGovernor::xPidUsage& usage = m_Governor->m_Usage[m_PID];
+    (m_Kind == eKind::Assembler ? usage.NumEvictions : usage.NumSpills)++;
+    return true;
+}
+
+void xMemoryAccount::AddSpilled(uint64_t Bytes)
+{
+    if (m_Governor)
+    {
+        m_Governor->m_Usage[m_PID].SpilledBytes += Bytes;
+    }
+}
+
+//=============================================================================================================================================================================
+// xMemoryGovernor
+//=============================================================================================================================================================================
+xMemoryGovernor::xMemoryGovernor() : xMemoryGovernor(xConfig())
+{
+}
+
+xMemoryGovernor::xMemoryGovernor(const xConfig& Config) : m_Config(Config), m_Usage(new xPidUsage[NumPIDs]),
+                                                          m_TotalBytes(0), m_PeakTotalBytes(0)
+{
+}
+
+void xMemoryGovernor::xRegister(xMemoryAccount* Account)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_Accounts.push_back(Account);
+}
+
+void xMemoryGovernor::xUnregister(xMemoryAccount* Account)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    std::vector<xMemoryAccount*>::iterator it = std::find(m_Accounts.begin(), m_Accounts.end(), Account);
+    if (it != m_Accounts.end())
+    {
+        *it = m_Accounts.back();
+        m_Accounts.pop_back();
+    }
+}
+
+bool xMemoryGovernor::xMakeRoom(xMemoryAccount* Account, uint64_t Bytes)
+{
+    if (!m_Config.GlobalCap || m_TotalBytes.load() + Bytes <= m_Config.GlobalCap)
+    {
+        return true;
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    // spilling loses no data, so every queue (including queues of finished ranges waiting for the file to be
+    // finalized) goes to disk before any PES is dropped
+    std::vector<xMemoryAccount*> busy;
+    while (m_TotalBytes.load() + Bytes > m_Config.GlobalCap)
+    {
+        xMemoryAccount* queue = xFindLargest(xMemoryAccount::eKind::OutputQueue, busy);
+        if (queue == nullptr)
+        {
+            break;
+        }
+        if (queue == Account)
+        {
+            return false; //the caller spills its own queue
+        }
+        if (queue->m_Queue->xTrySpill())
+        {
+            m_Usage[queue->m_PID].NumSpills++;
+        }
+        else
+        {
+            busy.push_back(queue); //being appended to or finalized right now
+        }
+    }
+    // a busy queue frees its bytes (or is spilled by the next charge) shortly, that is no reason to drop a PES
+    if (m_TotalBytes.load() + Bytes <= m_Config.GlobalCap || !busy.empty())
+    {
+        return true;
+    }
+    if (Account->m_Kind == xMemoryAccount::eKind::OutputQueue)
+    {
+        return false;
+    }
+
+    // no queue left to spill - drop the largest PES
+    xMemoryAccount* victim = xFindLargest(xMemoryAccount::eKind::Assembler, busy);
+    if (victim == Account)
+    {
+        return false;
+    }
+    if (victim)
+    {
+        victim->m_ShedRequested = true;
+    }
+    return true;
+}
+
+xMemoryAccount* xMemoryGovernor::xFindLargest(xMemoryAccount::eKind Kind,
+                                              const std::vector<xMemoryAccount*>& Skipped) const
+{
+    xMemoryAccount* largest = nullptr;
+    uint64_t largestBytes = 0;
+    for (xMemoryAccount* account : m_Accounts)
+    {
+        // accounts already asked to shed will free their bytes at their next packet
+        uint64_t bytes = account->getBytes();
+        if (account->m_Kind == Kind && bytes > largestBytes && !account->m_ShedRequested.load() &&
+            std::find(Skipped.begin(), Skipped.end(), account) == Skipped.end())
+        {
+            largest = account;
+            largestBytes = bytes;
+        }
+    }
+    return largest;
+}
+
+void xMemoryGovernor::xUpdatePeak(std::atomic<uint64_t>& Peak, uint64_t Value)
+{
+    uint64_t peak = Peak.load(std::memory_order_relaxed);
+    while (Value > peak && !Peak.compare_exchange_weak(peak, Value, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t xMemoryGovernor::getProcessPeakRSS()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+void xMemoryGovernor::Print(FILE* Output) const
+{
+    fprintf(Output, "Memory: current=%" PRIu64 " peak=%" PRIu64 " caps: assembler=%" PRIu64 " queue/PID=%" PRIu64
+            " global=%" PRIu64 " (0 - unlimited), process peak RSS=%" PRIu64 "\n", getTotalBytes(), getPeakTotalBytes(),
+            m_Config.AssemblerCap, m_Config.QueueCapPerPID, m_Config.GlobalCap, getProcessPeakRSS());
+    for (uint32_t PID = 0; PID < NumPIDs; PID++)
+    {
+        const xPidUsage& usage = m_Usage[PID];
+        if (!usage.AssemblerPeak && !usage.QueuePeak && !usage.NumEvictions && !usage.NumSpills)
+        {
+            continue;
+        }
+        fprintf(Output, "  PID=%u assembler=%" PRIu64 " (peak %" PRIu64 ") queue=%" PRIu64 " (peak %" PRIu64
+                ") spilled=%" PRIu64 " evictions=%u spills=%u\n", PID, usage.AssemblerBytes.load(),
+                usage.AssemblerPeak.load(), usage.QueueBytes.load(), usage.QueuePeak.load(), usage.SpilledBytes.load(),
+                usage.NumEvictions.load(), usage.NumSpills.load());
+    }
+}
+
+//=============================================================================================================================================================================
+// xSpillQueue
+//=============================================================================================================================================================================
+xSpillQueue::xSpillQueue() : m_Spill(nullptr), m_NumBytes(0)
+{
+}
+
+xSpillQueue::~xSpillQueue()
+{
+    Clear();
+}
+
+void xSpillQueue::Init(xMemoryGovernor* Governor, uint16_t PID)
+{
+    Clear();
+    m_Account.Attach(Governor, PID, xMemoryAccount::eKind::OutputQueue, this);
+}
+
+void xSpillQueue::Write(const uint8_t* Data, uint32_t Size)
+{
+    // charged without m_Mutex held - the governor may spill this queue while it makes room for the charge
+    bool isCharged = !isSpilled() && m_Account.Charge(Size);
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_NumBytes += Size;
+    if (isCharged && !m_Spill)
+    {
+        m_Data.insert(m_Data.end(), Data, Data + Size);
+        return;
+    }
+    if (m_Spill || xSpill())
+    {
+        // spilled by the governor around the charge - whatever is still charged belongs to data on disk
+        m_Account.ReleaseAll();
+        fwrite(Data, 1, Size, m_Spill);
+        m_Account.AddSpilled(Size);
+        return;
+    }
+    // no temporary file - keep the data, over the cap
+    if (!isCharged)
+    {
+        m_Account.Charge(Size, true);
+    }
+    m_Data.insert(m_Data.end(), Data, Data + Size);
+}
+
+bool xSpillQueue::xSpill()
+{
+    m_Spill = tmpfile();
+    if (m_Spill == NULL)
+    {
+        return false;
+    }
+    if (!m_Data.empty())
+    {
+        fwrite(m_Data.data(), 1, m_Data.size(), m_Spill);
+        m_Account.AddSpilled(m_Data.size());
+    }
+    std::vector<uint8_t>().swap(m_Data);
+    m_Account.ReleaseAll();
+    return true;
+}
+
+bool xSpillQueue::xTrySpill()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex, std::try_to_lock);
+    return lock.owns_lock() && !m_Spill && xSpill();
+}
+
+bool xSpillQueue::CopyTo(FILE* Output)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    bool ok = true;
+    if (m_Spill)
+    {
+        uint8_t block[64 * 1024];
+        rewind(m_Spill);
+        size_t numRead;
+        while ((numRead = fread(block, 1, sizeof(block), m_Spill)) > 0)
+        {
+            ok &= fwrite(block, 1, numRead, Output) == numRead;
+        }
+    }
+    if (!m_Data.empty())
+    {
+        ok &= fwrite(m_Data.data(), 1, m_Data.size(), Output) == m_Data.size();
+    }
+    return ok;
+}
+
+void xSpillQueue::Clear()
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Spill)
+    {
+        fclose(m_Spill);
+        m_Spill = nullptr;
+    }
+    std::vector<uint8_t>().swap(m_Data);
+    m_Account.ReleaseAll();
+    m_NumBytes = 0;
+}
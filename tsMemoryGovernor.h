@@ -0,0 +1,197 @@
+//tsMemoryGovernor.h
+
+#pragma once
+#include "tsCommon.h"
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+Memory governor:
+Every PES assembler and every output queue owns an xMemoryAccount attached to one governor. Accounts charge the bytes
+they hold (pending PES data, queued output) before keeping them and release them when the data is written or dropped.
+Usage is reported per PID (summed over all accounts of the PID, e.g. ranges of different files in batch mode).
+
+Assembler cap          -> per account, i.e. per PES stream of one file / range; Charge() fails and the assembler
+                          drops its own PES
+Queue cap per PID      -> shared by all queues of the PID; Charge() fails and the queue spills itself to disk
+Global cap exceeded    -> output queues are spilled first, largest first, also queues of other (e.g. finished)
+                          ranges; queues are charged without their lock held, so the governor spills them directly.
+                          Only when no queue holds any bytes the largest assembler is asked to drop its PES - if it is
+                          the charging account Charge() fails, otherwise it sheds at its next packet
+The governor counts logical bytes (charged PES data and queued output), not RSS - a buffer reused from xBufferPool keeps
+pages touched by earlier PES.
+*/
+
+class xMemoryGovernor;
+class xSpillQueue;
+
+//=============================================================================================================================================================================
+
+class xMemoryAccount {
+public:
+    enum class eKind : int32_t {
+        Assembler,
+        OutputQueue
+    };
+
+protected:
+    xMemoryGovernor *m_Governor;
+    xSpillQueue *m_Queue; //owner of an OutputQueue account, spilled by the governor under global pressure
+    uint16_t m_PID;
+    eKind m_Kind;
+    std::atomic<uint64_t> m_Bytes;
+    std::atomic<bool> m_ShedRequested;
+
+    friend class xMemoryGovernor;
+
+public:
+    xMemoryAccount();
+
+    ~xMemoryAccount();
+
+    xMemoryAccount(const xMemoryAccount &) = delete;
+    xMemoryAccount &operator=(const xMemoryAccount &) = delete;
+
+    void Attach(xMemoryGovernor *Governor, uint16_t PID, eKind Kind, xSpillQueue *Queue = nullptr);
+
+    void Detach();
+
+    //false - caller has to shed its own data instead of keeping Bytes more; Force ignores caps
+    bool Charge(uint64_t Bytes, bool Force = false) {
+        return !m_Governor || xCharge(Bytes, Force);
+    }
+
+    void ReleaseAll() {
+        if (m_Governor && m_Bytes.load(std::memory_order_relaxed)) {
+            xRelease(m_Bytes.load(std::memory_order_relaxed));
+        }
+    }
+
+    //true once per request made by the governor under global pressure
+    bool TakeShedRequest() {
+        return m_Governor && m_ShedRequested.load(std::memory_order_relaxed) && xTakeShedRequest();
+    }
+
+    void AddSpilled(uint64_t Bytes);
+
+    uint64_t getBytes() const { return m_Bytes.load(std::memory_order_relaxed); }
+    uint16_t getPID() const { return m_PID; }
+    eKind getKind() const { return m_Kind; }
+
+protected:
+    bool xCharge(uint64_t Bytes, bool Force);
+
+    void xRelease(uint64_t Bytes);
+
+    bool xTakeShedRequest();
+};
+
+//=============================================================================================================================================================================
+
+class xMemoryGovernor {
+public:
+    static constexpr uint32_t NumPIDs = 8192;
+
+    struct xConfig {
+        uint64_t AssemblerCap = 0; //bytes per assembler, 0 - unlimited
+        uint64_t QueueCapPerPID = 0;
+        uint64_t GlobalCap = 0;
+    };
+
+    struct xPidUsage {
+        std::atomic<uint64_t> AssemblerBytes{0};
+        std::atomic<uint64_t> AssemblerPeak{0};
+        std::atomic<uint64_t> QueueBytes{0};
+        std::atomic<uint64_t> QueuePeak{0};
+        std::atomic<uint64_t> SpilledBytes{0};
+        std::atomic<uint32_t> NumEvictions{0};
+        std::atomic<uint32_t> NumSpills{0};
+    };
+
+protected:
+    xConfig m_Config;
+    std::unique_ptr<xPidUsage[]> m_Usage;
+    std::atomic<uint64_t> m_TotalBytes;
+    std::atomic<uint64_t> m_PeakTotalBytes;
+    std::mutex m_Mutex;
+    std::vector<xMemoryAccount *> m_Accounts;
+
+    friend class xMemoryAccount;
+
+public:
+    xMemoryGovernor();
+
+    explicit xMemoryGovernor(const xConfig &Config);
+
+    xMemoryGovernor(const xMemoryGovernor &) = delete;
+    xMemoryGovernor &operator=(const xMemoryGovernor &) = delete;
+
+    void Print(FILE *Output) const;
+
+    const xConfig &getConfig() const { return m_Config; }
+    const xPidUsage &getUsage(uint16_t PID) const { return m_Usage[PID & (NumPIDs - 1)]; }
+    uint64_t getTotalBytes() const { return m_TotalBytes.load(); }
+    uint64_t getPeakTotalBytes() const { return m_PeakTotalBytes.load(); }
+
+    //peak resident set size of the whole process, 0 when unavailable
+    static uint64_t getProcessPeakRSS();
+
+protected:
+    void xRegister(xMemoryAccount *Account);
+
+    void xUnregister(xMemoryAccount *Account);
+
+    //frees room for Bytes more under the global cap; false - Account itself has to shed
+    bool xMakeRoom(xMemoryAccount *Account, uint64_t Bytes);
+
+    //largest account of Kind holding any bytes, skipping Skipped and accounts already asked to shed; m_Mutex held
+    xMemoryAccount *xFindLargest(xMemoryAccount::eKind Kind, const std::vector<xMemoryAccount *> &Skipped) const;
+
+    static void xUpdatePeak(std::atomic<uint64_t> &Peak, uint64_t Value);
+};
+
+//=============================================================================================================================================================================
+
+// Output queue kept in memory and charged to the governor; when it is over its cap or spilled by the governor, the
+// queued data (and everything written afterwards) goes to an anonymous temporary file instead.
+// The governor may spill a queue from another thread, so its data is guarded by m_Mutex.
+class xSpillQueue {
+protected:
+    mutable std::mutex m_Mutex;
+    std::vector<uint8_t> m_Data;
+    FILE *m_Spill;
+    xMemoryAccount m_Account;
+    uint64_t m_NumBytes;
+
+    friend class xMemoryGovernor;
+
+public:
+    xSpillQueue();
+
+    ~xSpillQueue();
+
+    xSpillQueue(const xSpillQueue &) = delete;
+    xSpillQueue &operator=(const xSpillQueue &) = delete;
+
+    void Init(xMemoryGovernor *Governor, uint16_t PID);
+
+    void Write(const uint8_t *Data, uint32_t Size);
+
+    //spilled part first, then the in-memory tail
+    bool CopyTo(FILE *Output);
+
+    void Clear();
+
+    uint64_t getNumBytes() const { std::lock_guard<std::mutex> lock(m_Mutex); return m_NumBytes; }
+    bool isSpilled() const { std::lock_guard<std::mutex> lock(m_Mutex); return m_Spill != nullptr; }
+
+protected:
+    //m_Mutex held
+    bool xSpill();
+
+    //called by the governor with its own mutex held; fails when the queue is being appended to or finalized
+    bool xTrySpill();
+};
@@ -0,0 +1,81 @@
+#include "tsPacketPolicy.h"
+
+//=============================================================================================================================================================================
+// xTS_PacketPolicy
+//=============================================================================================================================================================================
+xTS_PacketPolicy::xTS_PacketPolicy() : m_TransportErrorAction(eAction::Drop), m_ScrambledAction(eAction::Drop),
+                                       m_QuarantineSink(nullptr), m_PassthroughSink(nullptr),
+                                       m_NumTransportErrors(0), m_NumScrambled(0), m_NumQuarantined(0),
+                                       m_NumPassedThrough(0)
+{
+}
+
+void xTS_PacketPolicy::Init(eAction TransportErrorAction, eAction ScrambledAction, FILE* QuarantineSink)
+{
+    m_TransportErrorAction = TransportErrorAction;
+    m_ScrambledAction = ScrambledAction;
+    m_QuarantineSink = QuarantineSink;
+    m_PassthroughSink = nullptr;
+    m_PassthroughPIDs.reset();
+    std::vector<xPidCounters>().swap(m_Counters);
+    m_NumTransportErrors = 0;
+    m_NumScrambled = 0;
+    m_NumQuarantined = 0;
+    m_NumPassedThrough = 0;
+}
+
+xTS_PacketPolicy::eVerdict xTS_PacketPolicy::xReject(const uint8_t* TransportStreamPacket,
+                                                     const xTS_PacketHeader* PacketHeader)
+{
+    if (m_Counters.empty())
+    {
+        m_Counters.resize(NumPIDs);
+    }
+    xPidCounters& counters = m_Counters[PacketHeader->getPID()];
+
+    if (PacketHeader->getEByte())
+    {
+        counters.NumTransportErrors++;
+        m_NumTransportErrors++;
+        return xApply(m_TransportErrorAction, TransportStreamPacket);
+    }
+
+    counters.NumScrambled++;
+    m_NumScrambled++;
+    if (m_PassthroughSink && m_PassthroughPIDs.test(PacketHeader->getPID()))
+    {
+        fwrite(TransportStreamPacket, 1, xTS::TS_PacketLength, m_PassthroughSink);
+        counters.NumPassedThrough++;
+        m_NumPassedThrough++;
+        return eVerdict::PassedThrough;
+    }
+    return xApply(m_ScrambledAction, TransportStreamPacket);
+}
+
+xTS_PacketPolicy::eVerdict xTS_PacketPolicy::xApply(eAction Action, const uint8_t* TransportStreamPacket)
+{
+    if (Action == eAction::Quarantine && m_QuarantineSink)
+    {
+        fwrite(TransportStreamPacket, 1, xTS::TS_PacketLength, m_QuarantineSink);
+        m_NumQuarantined++;
+        return eVerdict::Quarantined;
+    }
+    return eVerdict::Dropped;
+}
+
+void xTS_PacketPolicy::Print() const
+{
+    printf("Policy: TEI=%llu Scrambled=%llu Quarantined=%llu PassedThrough=%llu\n",
+           (unsigned long long)m_NumTransportErrors, (unsigned long long)m_NumScrambled,
+           (unsigned long long)m_NumQuarantined, (unsigned long long)m_NumPassedThrough);
+    for (uint32_t PID = 0; PID < m_Counters.size(); PID++)
+    {
+        const xPidCounters& counters = m_Counters[PID];
+        if (counters.NumTransportErrors || counters.NumScrambled)
+        {
+            printf("  PID=%u TEI=%llu Scrambled=%llu PassedThrough=%llu\n", PID,
+                   (unsigned long long)counters.NumTransportErrors, (unsigned long long)counters.NumScrambled,
+                   (unsigned long long)counters.NumPassedThrough);
+        }
+    }
+}
@@ -0,0 +1,93 @@
+//tsPacketPolicy.h
+
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include <bitset>
+#include <cstdio>
+#include <vector>
+
+/*
+Packet policy - applied right after header parsing, before PID dispatch and before any payload copy.
+Packets with transport_error_indicator set or with transport_scrambling_control != '00' never reach the assemblers,
+so they can neither be appended to a PES nor reset one with a corrupted PUSI/PID/CC.
+
+transport_error_indicator set -> TransportErrorAction (the PID may itself be corrupted, it is counted as received)
+TSC != '00', PID selected       -> raw copy to passthrough sink
+TSC != '00', other PIDs         -> ScrambledAction
+Quarantine writes the raw packet to the quarantine sink (same as Drop when there is no sink).
+*/
+
+//=============================================================================================================================================================================
+
+class xTS_PacketPolicy {
+public:
+    static constexpr uint32_t NumPIDs = 8192;
+
+    enum class eAction : int32_t {
+        Drop,
+        Quarantine
+    };
+
+    enum class eVerdict : int32_t {
+        Accept,
+        Dropped,
+        Quarantined,
+        PassedThrough
+    };
+
+    struct xPidCounters {
+        uint64_t NumTransportErrors = 0;
+        uint64_t NumScrambled = 0;
+        uint64_t NumPassedThrough = 0;
+    };
+
+protected:
+    eAction m_TransportErrorAction;
+    eAction m_ScrambledAction;
+    FILE *m_QuarantineSink;
+    FILE *m_PassthroughSink;
+    std::bitset<NumPIDs> m_PassthroughPIDs;
+    std::vector<xPidCounters> m_Counters;
+    uint64_t m_NumTransportErrors;
+    uint64_t m_NumScrambled;
+    uint64_t m_NumQuarantined;
+    uint64_t m_NumPassedThrough;
+
+public:
+    xTS_PacketPolicy();
+
+    void Init(eAction TransportErrorAction = eAction::Drop, eAction ScrambledAction = eAction::Drop,
+              FILE *QuarantineSink = nullptr);
+
+    void setPassthroughSink(FILE *PassthroughSink) { m_PassthroughSink = PassthroughSink; }
+    void addPassthroughPID(uint16_t PID) { m_PassthroughPIDs.set(PID & (NumPIDs - 1)); }
+
+    //the accept rule: no transport error, not scrambled
+    static bool isClean(const xTS_PacketHeader &PacketHeader) {
+        return !PacketHeader.getEByte() && PacketHeader.getTSC() == 0;
+    }
+
+    eVerdict Check(const uint8_t *TransportStreamPacket, const xTS_PacketHeader *PacketHeader) {
+        if (isClean(*PacketHeader)) {
+            return eVerdict::Accept;
+        }
+        return xReject(TransportStreamPacket, PacketHeader);
+    }
+
+    void Print() const;
+
+    //per-PID counters are allocated on the first rejected packet
+    xPidCounters getCounters(uint16_t PID) const {
+        return m_Counters.empty() ? xPidCounters() : m_Counters[PID & (NumPIDs - 1)];
+    }
+    uint64_t getNumTransportErrors() const { return m_NumTransportErrors; }
+    uint64_t getNumScrambled() const { return m_NumScrambled; }
+    uint64_t getNumQuarantined() const { return m_NumQuarantined; }
+    uint64_t getNumPassedThrough() const { return m_NumPassedThrough; }
+
+protected:
+    eVerdict xReject(const uint8_t *TransportStreamPacket, const xTS_PacketHeader *PacketHeader);
+
+    eVerdict xApply(eAction Action, const uint8_t *TransportStreamPacket);
+};
@@ -0,0 +1,48 @@
+#include "tsPipeline.h"
+
+//=============================================================================================================================================================================
+// Prebuilt profiles
+//=============================================================================================================================================================================
+using xPipeline_MP2_136 = xTS_Pipeline<xPidFilter_Fixed<xTS_PipelineDispatcher::PID_AUDIO_MP2>, xAF_LengthOnly, xPES_Quiet, xSink_File>;
+using xPipeline_Extract = xTS_Pipeline<xPidFilter_Runtime, xAF_LengthOnly, xPES_Quiet, xSink_File>;
+using xPipeline_Validate = xTS_Pipeline<xPidFilter_Runtime, xAF_LengthOnly, xPES_Quiet, xSink_Null>;
+using xPipeline_Verbose = xTS_Pipeline<xPidFilter_Runtime, xAF_Full, xPES_Verbose, xSink_File>;
+
+//=============================================================================================================================================================================
+// xTS_PipelineDispatcher
+//=============================================================================================================================================================================
+const char* xTS_PipelineDispatcher::getName(const xProfile& Profile)
+{
+    if (Profile.Verbose)
+    {
+        return "verbose";
+    }
+    if (Profile.Discard)
+    {
+        return "validate";
+    }
+    return Profile.PID == PID_AUDIO_MP2 ? "mp2-136" : "extract";
+}
+
+xPipelineStats xTS_PipelineDispatcher::Run(const xProfile& Profile, FILE* Input, FILE* Output,
+                                           xTS_PacketPolicy* PacketPolicy, uint64_t MaxPackets,
+                                           xMemoryGovernor* Governor)
+{
+    if (Profile.Verbose)
+    {
+        xPipeline_Verbose pipeline(xPidFilter_Runtime(Profile.PID), xSink_File(Output), PacketPolicy, nullptr, Governor);
+        return pipeline.Run(Input, MaxPackets);
+    }
+    if (Profile.Discard)
+    {
+        xPipeline_Validate pipeline(xPidFilter_Runtime(Profile.PID), xSink_Null(), PacketPolicy, nullptr, Governor);
+        return pipeline.Run(Input, MaxPackets);
+    }
+    if (Profile.PID == PID_AUDIO_MP2)
+    {
+        xPipeline_MP2_136 pipeline(xPidFilter_Fixed<PID_AUDIO_MP2>(), xSink_File(Output), PacketPolicy, nullptr, Governor);
+        return pipeline.Run(Input, MaxPackets);
+    }
+    xPipeline_Extract pipeline(xPidFilter_Runtime(Profile.PID), xSink_File(Output), PacketPolicy, nullptr, Governor);
+    return pipeline.Run(Input, MaxPackets);
+}
@@ -0,0 +1,293 @@
+//tsPipeline.h
+
+#pragma once
+#include "tsCommon.h"
+#include "tsTransportStream.h"
+#include "tsPacketPolicy.h"
+#include <cstdio>
+#include <vector>
+
+/*
+Demux pipeline built from compile-time policies:
+PID filter -> adaptation field parse -> PES assembly -> sink
+
+tPidFilter : bool Match(uint16_t PID) const, uint16_t getPID() const
+tAFPolicy  : static void Parse(xTS_AdaptationField&, const uint8_t* Packet, const xTS_PacketHeader&)
+tPESPolicy : void Init(int32_t PID, xBufferPool*, xMemoryGovernor*), Absorb<tSink>(Packet, Header, AF, PacketId, Sink), getAssembler()
+             (Absorb hands a finished PES to the sink, the pipeline resets the assembler afterwards)
+tSink      : void Write(const uint8_t* Data, uint32_t Size)
+
+Every choice that is fixed for a profile (PID, AF parsing, verbosity, sink type) is a template argument, so each
+instantiation is compiled into its own packet loop. The PES policies call the inline xPES_Assembler::AbsorbMatched, so
+the assembler's PID check is left to the filter and the continuation path is compiled into the loop; checks that depend
+on the packet (AFC, CC, PUSI) remain. xTS_PipelineDispatcher picks the prebuilt instantiation for a profile.
+*/
+
+//=============================================================================================================================================================================
+// PID filter policies
+//=============================================================================================================================================================================
+template <uint16_t PID>
+class xPidFilter_Fixed {
+public:
+    static constexpr bool Match(uint16_t PacketPID) { return PacketPID == PID; }
+    static constexpr uint16_t getPID() { return PID; }
+};
+
+class xPidFilter_Runtime {
+protected:
+    uint16_t m_PID;
+
+public:
+    explicit xPidFilter_Runtime(uint16_t PID = 0) : m_PID(PID) {}
+
+    bool Match(uint16_t PacketPID) const { return PacketPID == m_PID; }
+    uint16_t getPID() const { return m_PID; }
+};
+
+//=============================================================================================================================================================================
+// Adaptation field policies
+//=============================================================================================================================================================================
+class xAF_LengthOnly {
+public:
+    static void Parse(xTS_AdaptationField &AdaptationField, const uint8_t *Packet, const xTS_PacketHeader &Header) {
+        AdaptationField.ParseLength(Packet, Header.getAFC());
+    }
+};
+
+class xAF_Full {
+public:
+    static void Parse(xTS_AdaptationField &AdaptationField, const uint8_t *Packet, const xTS_PacketHeader &Header) {
+        AdaptationField.Reset();
+        if (Header.hasAdaptationField()) {
+            AdaptationField.Parse(Packet, Header.getAFC());
+        }
+    }
+};
+
+//=============================================================================================================================================================================
+// PES policies
+//=============================================================================================================================================================================
+class xPES_Quiet {
+protected:
+    xPES_Assembler m_Assembler;
+
+public:
+    void Init(int32_t PID, xBufferPool *Pool, xMemoryGovernor *Governor) { m_Assembler.Init(PID, Pool, Governor); }
+
+    xPES_Assembler &getAssembler() { return m_Assembler; }
+    const xPES_Assembler &getAssembler() const { return m_Assembler; }
+
+    template <class tSink>
+    xPES_Assembler::eResult Absorb(const uint8_t *Packet, const xTS_PacketHeader &Header,
+                                   const xTS_AdaptationField &AdaptationField, int32_t /*PacketId*/, tSink &Sink) {
+        xPES_Assembler::eResult result = m_Assembler.AbsorbMatched(Packet, Header, AdaptationField.getNumBytes());
+        if (result == xPES_Assembler::eResult::AssemblingFinished) {
+            Sink.Write(m_Assembler.getPacket(), m_Assembler.getNumPacketBytes());
+        }
+        return result;
+    }
+};
+
+// same output as the interactive single-file mode
+class xPES_Verbose : public xPES_Quiet {
+public:
+    template <class tSink>
+    xPES_Assembler::eResult Absorb(const uint8_t *Packet, const xTS_PacketHeader &Header,
+                                   const xTS_AdaptationField &AdaptationField, int32_t PacketId, tSink &Sink) {
+        printf("Pakiet TS %010d: ", PacketId);
+        Header.Print();
+        if (Header.hasAdaptationField()) {
+            AdaptationField.Print();
+        }
+
+        uint32_t numPESCRCErrors = m_Assembler.getNumPESCRCErrors();
+        xPES_Assembler::eResult result = m_Assembler.AbsorbMatched(Packet, Header, AdaptationField.getNumBytes());
+        switch (result) {
+            case xPES_Assembler::eResult::AssemblingStarted:
+                printf("Assembling Started: \n");
+                m_Assembler.PrintPESH();
+                if (m_Assembler.getNumPESCRCErrors() != numPESCRCErrors) {
+                    printf("PES CRC mismatch for PID %d! Previous PES data is corrupted.\n", Header.getPID());
+                }
+                break;
+            case xPES_Assembler::eResult::AssemblingFinished:
+                printf("Assembling Finished: \n");
+                printf("PES: PacketLen=%d HeadLen=%d DataLen=%d\n",
+                       m_Assembler.getNumPacketBytes() + m_Assembler.getHeaderLength(),
+                       m_Assembler.getHeaderLength(), m_Assembler.getNumPacketBytes());
+                Sink.Write(m_Assembler.getPacket(), m_Assembler.getNumPacketBytes());
+                break;
+            case xPES_Assembler::eResult::StreamPacketLost:
+                printf("Stream Packet Lost for PID %d! Resetting assembler.\n", Header.getPID());
+                break;
+            case xPES_Assembler::eResult::BufferOverflow:
+                printf("PES Assembler Buffer Overflow for PID %d! Resetting.\n", Header.getPID());
+                break;
+            case xPES_Assembler::eResult::Evicted:
+                printf("PES evicted by memory governor for PID %d! Resetting.\n", Header.getPID());
+                break;
+            default: break;
+        }
+        return result;
+    }
+};
+
+//=============================================================================================================================================================================
+// Sink policies
+//=============================================================================================================================================================================
+class xSink_File {
+protected:
+    FILE *m_File;
+
+public:
+    explicit xSink_File(FILE *File = nullptr) : m_File(File) {}
+
+    void Write(const uint8_t *Data, uint32_t Size) {
+        if (m_File) {
+            fwrite(Data, 1, Size, m_File);
+        }
+    }
+};
+
+// memory queue charged to the memory governor, spills to a temporary file under pressure
+class xSink_Queue {
+protected:
+    xSpillQueue *m_Queue;
+
+public:
+    explicit xSink_Queue(xSpillQueue *Queue = nullptr) : m_Queue(Queue) {}
+
+    void Write(const uint8_t *Data, uint32_t Size) { m_Queue->Write(Data, Size); }
+};
+
+class xSink_Null {
+public:
+    void Write(const uint8_t * /*Data*/, uint32_t /*Size*/) {}
+};
+
+//=============================================================================================================================================================================
+
+struct xPipelineStats {
+    uint64_t NumPackets = 0;
+    uint64_t NumSyncErrors = 0;
+    uint64_t NumPES = 0;
+    uint64_t NumOutputBytes = 0;
+    uint32_t NumPacketsLost = 0;
+    uint32_t NumOverflows = 0;
+    uint32_t NumEvictions = 0;
+    uint32_t NumPESCRCErrors = 0;
+};
+
+//=============================================================================================================================================================================
+
+template <class tPidFilter, class tAFPolicy, class tPESPolicy, class tSink>
+class xTS_Pipeline {
+public:
+    static constexpr uint32_t BlockPackets = 1024;
+
+protected:
+    [[no_unique_address]] tPidFilter m_PidFilter;
+    tPESPolicy m_PES;
+    tSink m_Sink;
+    xTS_PacketPolicy *m_PacketPolicy;
+    xTS_PacketHeader m_PacketHeader;
+    xTS_AdaptationField m_AdaptationField;
+    xPipelineStats m_Stats;
+
+public:
+    xTS_Pipeline(tPidFilter PidFilter, tSink Sink, xTS_PacketPolicy *PacketPolicy, xBufferPool *Pool = nullptr,
+                 xMemoryGovernor *Governor = nullptr)
+        : m_PidFilter(PidFilter), m_Sink(Sink), m_PacketPolicy(PacketPolicy) {
+        m_PES.Init(m_PidFilter.getPID(), Pool, Governor);
+        m_AdaptationField.Reset();
+    }
+
+    //Header has to be parsed, synced and accepted by the packet policy
+    xPES_Assembler::eResult Process(const uint8_t *Packet, const xTS_PacketHeader &Header, int32_t PacketId) {
+        if (!m_PidFilter.Match(Header.getPID())) {
+            return xPES_Assembler::eResult::UnexpectedPID;
+        }
+        tAFPolicy::Parse(m_AdaptationField, Packet, Header);
+        xPES_Assembler::eResult result = m_PES.Absorb(Packet, Header, m_AdaptationField, PacketId, m_Sink);
+        switch (result) {
+            case xPES_Assembler::eResult::AssemblingFinished:
+                m_Stats.NumPES++;
+                m_Stats.NumOutputBytes += m_PES.getAssembler().getNumPacketBytes();
+                m_PES.getAssembler().Reset();
+                break;
+            case xPES_Assembler::eResult::StreamPacketLost:
+                m_Stats.NumPacketsLost++;
+                m_PES.getAssembler().Reset();
+                break;
+            case xPES_Assembler::eResult::BufferOverflow:
+                m_Stats.NumOverflows++;
+                m_PES.getAssembler().Reset();
+                break;
+            case xPES_Assembler::eResult::Evicted:
+                m_Stats.NumEvictions++;
+                m_PES.getAssembler().Reset();
+                break;
+            default: break;
+        }
+        return result;
+    }
+
+    //MaxPackets == 0 - whole input
+    const xPipelineStats &Run(FILE *Input, uint64_t MaxPackets = 0) {
+        std::vector<uint8_t> block(BlockPackets * xTS::TS_PacketLength);
+        uint32_t numBlockPackets = 0;
+        uint32_t blockIndex = 0;
+
+        while (MaxPackets == 0 || m_Stats.NumPackets < MaxPackets) {
+            if (blockIndex == numBlockPackets) {
+                numBlockPackets = (uint32_t)(fread(block.data(), 1, block.size(), Input) / xTS::TS_PacketLength);
+                blockIndex = 0;
+                if (numBlockPackets == 0) {
+                    break;
+                }
+            }
+            const uint8_t *packet = &block[blockIndex++ * xTS::TS_PacketLength];
+            int32_t packetId = (int32_t)m_Stats.NumPackets++;
+
+            m_PacketHeader.Parse(packet);
+            if (m_PacketHeader.getSyncByte() != 0x47) {
+                m_Stats.NumSyncErrors++;
+                continue;
+            }
+            if (m_PacketPolicy &&
+                m_PacketPolicy->Check(packet, &m_PacketHeader) != xTS_PacketPolicy::eVerdict::Accept) {
+                continue;
+            }
+            Process(packet, m_PacketHeader, packetId);
+        }
+        m_Stats.NumPESCRCErrors = m_PES.getAssembler().getNumPESCRCErrors();
+        return m_Stats;
+    }
+
+    bool isAssembling() const { return m_PES.getAssembler().isAssembling(); }
+    uint16_t getPID() const { return m_PidFilter.getPID(); }
+
+    const xPipelineStats &getStats() {
+        m_Stats.NumPESCRCErrors = m_PES.getAssembler().getNumPESCRCErrors();
+        return m_Stats;
+    }
+};
+
+//=============================================================================================================================================================================
+
+class xTS_PipelineDispatcher {
+public:
+    static constexpr uint16_t PID_AUDIO_MP2 = 136;
+
+    struct xProfile {
+        uint16_t PID = PID_AUDIO_MP2;
+        bool Verbose = false;
+        bool Discard = false; //validate only, no output is written
+    };
+
+public:
+    static const char *getName(const xProfile &Profile);
+
+    static xPipelineStats Run(const xProfile &Profile, FILE *Input, FILE *Output, xTS_PacketPolicy *PacketPolicy,
+                              uint64_t MaxPackets = 0, xMemoryGovernor *Governor = nullptr);
+};
@@ -1,4 +1,5 @@
 #include "tsTransportStream.h"
+#include "tsCRC.h"
 #include <cstring>
 
 
@@ -151,15 +152,19 @@ void xPES_PacketHeader::Reset()
     m_StreamId = 0;
     m_PacketLength = 0;
     m_HeaderLength = 0;
+    m_PES_CRC_flag = 0;
+    m_PreviousPESPacketCRC = 0;
 }
 
-int32_t xPES_PacketHeader::Parse(const uint8_t* Input)
+int32_t xPES_PacketHeader::Parse(const uint8_t* Input, uint32_t Length)
 {
     m_PacketStartCodePrefix = ((uint32_t)Input[0] << 16) | ((uint32_t)Input[1] << 8) | Input[2];
     m_StreamId = Input[3];
     m_PacketLength = ((uint16_t)Input[4] << 8) | Input[5];
 
     m_HeaderLength = xTS::PES_HeaderLength; // Base PES header length
+    m_PES_CRC_flag = 0;
+    m_PreviousPESPacketCRC = 0;
 
     uint8_t currentStreamId = m_StreamId;
 
@@ -172,6 +177,11 @@ int32_t xPES_PacketHeader::Parse(const uint8_t* Input)
         currentStreamId != (uint8_t)xPES_PacketHeader::eStreamId::eStreamId_DSMCC_stream &&
         currentStreamId != (uint8_t)xPES_PacketHeader::eStreamId::eStreamId_ITUT_H222_1_type_E)
     {
+        if (Length < 9)
+        {
+            m_HeaderLength = 9; // optional header is cut off - rejected by the caller's length check
+            return m_PacketStartCodePrefix;
+        }
         uint8_t pes_header_data_length = Input[6];
         m_HeaderLength += 1 + pes_header_data_length;
 
@@ -183,6 +193,29 @@ int32_t xPES_PacketHeader::Parse(const uint8_t* Input)
             uint8_t pes_header_data_len_byte = Input[8];
 
             m_HeaderLength = 9 + pes_header_data_len_byte;
+
+            m_PES_CRC_flag = (flags_byte_2 >> 1) & 0x01;
+            if (m_PES_CRC_flag)
+            {
+                uint32_t pointer = 9;
+                uint8_t PTS_DTS_flags = (flags_byte_2 >> 6) & 0x03;
+                if (PTS_DTS_flags == 0x02) { pointer += 5; }
+                if (PTS_DTS_flags == 0x03) { pointer += 10; }
+                if (flags_byte_2 & 0x20) { pointer += 6; } // ESCR
+                if (flags_byte_2 & 0x10) { pointer += 3; } // ES_rate
+                if (flags_byte_2 & 0x08) { pointer += 1; } // DSM_trick_mode
+                if (flags_byte_2 & 0x04) { pointer += 1; } // additional_copy_info
+
+                // the field may lie past the end of this packet's payload - the caller rejects such a header
+                if (pointer + 2 <= m_HeaderLength && pointer + 2 <= Length)
+                {
+                    m_PreviousPESPacketCRC = ((uint16_t)Input[pointer] << 8) | Input[pointer + 1];
+                }
+                else
+                {
+                    m_PES_CRC_flag = 0;
+                }
+            }
         }
     }
     else
@@ -199,35 +232,44 @@ void xPES_PacketHeader::Print() const
     printf("PSCP=0x%06X ", m_PacketStartCodePrefix);
     printf("SID=0x%02X ", m_StreamId);
     printf("L=%u ", m_PacketLength);
-    printf("HL=%u\n", m_HeaderLength);
+    printf("HL=%u", m_HeaderLength);
+    if (m_PES_CRC_flag)
+    {
+        printf(" CRC=0x%04X", m_PreviousPESPacketCRC);
+    }
+    printf("\n");
 }
 
 //=============================================================================================================================================================================
 // xPES_Assembler
 //=============================================================================================================================================================================
-xPES_Assembler::xPES_Assembler() : m_PID(0), m_Buffer(nullptr), m_BufferSize(0), m_LastContinuityCounter(-1),
-                                   m_Started(false)
+xPES_Assembler::xPES_Assembler() : m_PID(0), m_Buffer(nullptr), m_BufferSize(0), m_Pool(nullptr), m_LastContinuityCounter(-1),
+                                   m_Started(false), m_PESCRCPresent(false), m_LastDataCRCValid(false),
+                                   m_LastDataCRC(0), m_DataCRCContinuityCounter(-1), m_NumPESCRCErrors(0)
 {
 }
 
 xPES_Assembler::~xPES_Assembler()
 {
-    delete[] m_Buffer;
-    m_Buffer = nullptr;
+    xBufferRelease();
 }
 
-void xPES_Assembler::Init(int32_t PID)
+void xPES_Assembler::Init(int32_t PID, xBufferPool* Pool, xMemoryGovernor* Governor)
 {
     m_PID = PID;
-    if (m_Buffer)
-    {
-        delete[] m_Buffer;
-    }
-    m_Buffer = new uint8_t[200000];
+    m_MemoryAccount.Attach(Governor, (uint16_t)PID, xMemoryAccount::eKind::Assembler);
+    xBufferRelease();
+    m_Pool = (Pool && Pool->getBufferSize() >= BufferCapacity) ? Pool : nullptr;
+    m_Buffer = m_Pool ? m_Pool->Acquire() : new uint8_t[BufferCapacity];
     m_BufferSize = 0;
     m_LastContinuityCounter = -1;
     m_Started = false;
     m_PESH.Reset();
+    m_PESCRCPresent = false;
+    m_LastDataCRCValid = false;
+    m_LastDataCRC = 0;
+    m_DataCRCContinuityCounter = -1;
+    m_NumPESCRCErrors = 0;
 }
 
 xPES_Assembler::eResult xPES_Assembler::AbsorbPacket(const uint8_t* TransportStreamPacket,
@@ -238,119 +280,117 @@ xPES_Assembler::eResult xPES_Assembler::AbsorbPacket(const uint8_t* TransportStr
     {
         return eResult::UnexpectedPID;
     }
+    return AbsorbMatched(TransportStreamPacket, *PacketHeader,
+                         PacketHeader->hasAdaptationField() ? AdaptationField->getNumBytes() : 0);
+}
 
-    uint8_t currentCC = PacketHeader->getCC();
-
-    if (m_Started && PacketHeader->hasContinuityCounter() && m_LastContinuityCounter != -1)
+xPES_Assembler::eResult xPES_Assembler::xAbsorbStart(const uint8_t* TransportStreamPacket, uint32_t PayloadOffset,
+                                                     uint32_t PayloadLength)
+{
+    if (m_Started)
     {
-        if (((m_LastContinuityCounter + 1) & 0x0F) != currentCC)
-        {
-            m_Started = false;
-            m_BufferSize = 0;
-            m_PESH.Reset();
-            m_LastContinuityCounter = -1;
-            return eResult::StreamPacketLost;
-        }
+        xBufferClear();
+        m_PESH.Reset();
     }
-    m_LastContinuityCounter = currentCC;
 
-    uint32_t tsAdaptationFieldLength = 0;
-    if (PacketHeader->hasAdaptationField())
+    if (PayloadLength < xTS::PES_HeaderLength)
     {
-        tsAdaptationFieldLength = AdaptationField->getNumBytes();
+        m_Started = false;
+        return eResult::BufferOverflow;
     }
+    m_PESH.Parse(&TransportStreamPacket[PayloadOffset], PayloadLength);
 
-    uint32_t payloadOffset = xTS::TS_HeaderLength + tsAdaptationFieldLength;
-    uint32_t tsPayloadLength = xTS::TS_PacketLength - payloadOffset;
-
-    if (!PacketHeader->hasPayload())
+    uint32_t pesHeaderLength = m_PESH.getHeaderLength();
+    if (PayloadLength < pesHeaderLength)
     {
-        return eResult::NoPayload;
+        m_Started = false;
+        return eResult::BufferOverflow;
     }
 
-    if (PacketHeader->getPayloadUnitStartIndicator())
+    if (m_PESH.hasPreviousPESPacketCRC())
     {
-        if (m_Started)
-        {
-            m_BufferSize = 0;
-            m_PESH.Reset();
-        }
-
-        if (tsPayloadLength < xTS::PES_HeaderLength)
-        {
-            m_Started = false;
-            return eResult::BufferOverflow;
-        }
-        m_PESH.Parse(&TransportStreamPacket[payloadOffset]);
-
-        uint32_t pesHeaderLength = m_PESH.getHeaderLength();
-        if (tsPayloadLength < pesHeaderLength)
+        if (m_PESCRCPresent && m_LastDataCRCValid && m_PESH.getPreviousPESPacketCRC() != m_LastDataCRC)
         {
-            m_Started = false;
-            return eResult::BufferOverflow;
+            m_NumPESCRCErrors++;
         }
+        m_PESCRCPresent = true;
+    }
+    m_LastDataCRCValid = false;
 
-        uint32_t dataToCopyLength = tsPayloadLength - pesHeaderLength;
-        if (m_BufferSize + dataToCopyLength > 200000)
-        {
-            m_Started = false;
-            return eResult::BufferOverflow;
-        }
-        xBufferAppend(&TransportStreamPacket[payloadOffset + pesHeaderLength], dataToCopyLength);
-        m_Started = true;
-        return eResult::AssemblingStarted;
+    uint32_t dataToCopyLength = PayloadLength - pesHeaderLength;
+    if (m_BufferSize + dataToCopyLength > BufferCapacity)
+    {
+        m_Started = false;
+        return eResult::BufferOverflow;
     }
-    else
+    if (!m_MemoryAccount.Charge(dataToCopyLength))
     {
-        if (!m_Started)
-        {
-            return eResult::UnexpectedPID;
-        }
-
-        uint32_t dataToCopyLength = tsPayloadLength;
-        if (m_BufferSize + dataToCopyLength > 200000)
-        {
-            m_Started = false;
-            return eResult::BufferOverflow;
-        }
-        xBufferAppend(&TransportStreamPacket[payloadOffset], dataToCopyLength);
-
-        if (m_PESH.getPacketLength() > 0 && (m_BufferSize + m_PESH.getHeaderLength()) >= (m_PESH.getPacketLength() + 6))
-        {
-            m_Started = false;
-            return eResult::AssemblingFinished;
-        }
-        else
-        {
-            return eResult::AssemblingContinue;
-        }
+        m_Started = false;
+        return eResult::Evicted;
     }
+    xBufferAppend(&TransportStreamPacket[PayloadOffset + pesHeaderLength], dataToCopyLength);
+    m_Started = true;
+    return eResult::AssemblingStarted;
+}
+
+xPES_Assembler::eResult xPES_Assembler::xDropPES(eResult Result)
+{
+    m_Started = false;
+    xBufferClear();
+    m_PESH.Reset();
+    m_LastDataCRCValid = false;
+    return Result;
 }
 
 void xPES_Assembler::xBufferReset()
 {
     m_PESH.Reset();
-    if (m_Buffer)
-    {
-        memset(m_Buffer, 0, 200000);
-    }
-    m_BufferSize = 0;
+    xBufferClear();
     m_Started = false;
     m_LastContinuityCounter = -1;
 }
 
-void xPES_Assembler::xBufferAppend(const uint8_t* data, uint32_t size)
+void xPES_Assembler::xBufferClear()
 {
-    if (m_Buffer && (m_BufferSize + size) <= 200000)
+    m_MemoryAccount.ReleaseAll();
+    m_BufferSize = 0;
+}
+
+void xPES_Assembler::xBufferRelease()
+{
+    if (m_Pool)
     {
-        memcpy(m_Buffer + m_BufferSize, data, size);
-        m_BufferSize += size;
+        m_Pool->Release(m_Buffer);
+    }
+    else
+    {
+        delete[] m_Buffer;
     }
+    m_Buffer = nullptr;
+    m_Pool = nullptr;
+}
+
+void xPES_Assembler::xUpdateDataCRC()
+{
+    if (!m_PESCRCPresent)
+    {
+        return;
+    }
+    // PES_packet_data_bytes only - trailing bytes past PES_packet_length are not covered
+    uint32_t dataLength = m_BufferSize;
+    uint32_t declaredDataLength = m_PESH.getPacketLength() + xTS::PES_HeaderLength - m_PESH.getHeaderLength();
+    if (m_PESH.getPacketLength() > 0 && declaredDataLength < dataLength)
+    {
+        dataLength = declaredDataLength;
+    }
+    m_LastDataCRC = xCRC16::Calc(m_Buffer, dataLength);
+    m_LastDataCRCValid = true;
 }
 
 void xPES_Assembler::assemblerPes(const uint8_t* TS_PacketBuffer, const xTS_PacketHeader* TS_PacketHeader,
                                   const xTS_AdaptationField* TS_AdaptationField, FILE* File)
 {
+    uint32_t numPESCRCErrors = m_NumPESCRCErrors;
     xPES_Assembler::eResult result = AbsorbPacket(TS_PacketBuffer, TS_PacketHeader, TS_AdaptationField);
     switch (result)
     {
@@ -358,6 +398,10 @@ void xPES_Assembler::assemblerPes(const uint8_t* TS_PacketBuffer, const xTS_Pack
         {
             printf("Assembling Started: \n");
             PrintPESH();
+            if (m_NumPESCRCErrors != numPESCRCErrors)
+            {
+                printf("PES CRC mismatch for PID %d! Previous PES data is corrupted.\n", m_PID);
+            }
             break;
         }
     case xPES_Assembler::eResult::AssemblingContinue:
@@ -393,6 +437,12 @@ void xPES_Assembler::assemblerPes(const uint8_t* TS_PacketBuffer, const xTS_Pack
             xBufferReset();
             break;
         }
+    case xPES_Assembler::eResult::Evicted:
+        {
+            printf("PES evicted by memory governor for PID %d! Resetting.\n", m_PID);
+            xBufferReset();
+            break;
+        }
     default: break;
     }
 }
@@ -404,3 +454,149 @@ void xPES_Assembler::saveBufferToFile(FILE* AudioMP2)
         fwrite(getPacket(), 1, getNumPacketBytes(), AudioMP2);
     }
 }
+
+//=============================================================================================================================================================================
+// xPSI_Assembler
+//=============================================================================================================================================================================
+xPSI_Assembler::xPSI_Assembler() : m_PID(0), m_BufferSize(0), m_SectionLength(0), m_LastContinuityCounter(-1),
+                                   m_Started(false), m_NumValid(0), m_NumCRCErrors(0), m_NumLost(0)
+{
+}
+
+void xPSI_Assembler::Init(int32_t PID)
+{
+    m_PID = PID;
+    m_LastContinuityCounter = -1;
+    m_NumValid = 0;
+    m_NumCRCErrors = 0;
+    m_NumLost = 0;
+    xSectionReset();
+}
+
+xPSI_Assembler::eResult xPSI_Assembler::AbsorbPacket(const uint8_t* TransportStreamPacket,
+                                                     const xTS_PacketHeader* PacketHeader,
+                                                     const xTS_AdaptationField* AdaptationField)
+{
+    if (PacketHeader->getPID() != m_PID)
+    {
+        return eResult::UnexpectedPID;
+    }
+    if (!PacketHeader->hasPayload())
+    {
+        return eResult::NoPayload;
+    }
+
+    eResult result = eResult::AssemblingContinue;
+
+    uint8_t currentCC = PacketHeader->getCC();
+    if (m_Started && m_LastContinuityCounter != -1 && ((m_LastContinuityCounter + 1) & 0x0F) != currentCC)
+    {
+        m_NumLost++;
+        result = eResult::SectionLost;
+        xSectionReset();
+    }
+    m_LastContinuityCounter = currentCC;
+
+    uint32_t tsAdaptationFieldLength = 0;
+    if (PacketHeader->hasAdaptationField())
+    {
+        tsAdaptationFieldLength = AdaptationField->getNumBytes();
+    }
+    uint32_t offset = xTS::TS_HeaderLength + tsAdaptationFieldLength;
+    if (offset >= xTS::TS_PacketLength)
+    {
+        return result;
+    }
+
+    if (!PacketHeader->getPayloadUnitStartIndicator())
+    {
+        if (m_Started)
+        {
+            // a section ending in a non-PUSI packet is followed by stuffing only
+            xConsume(&TransportStreamPacket[offset], xTS::TS_PacketLength - offset, result);
+        }
+        return result;
+    }
+
+    uint32_t pointerField = TransportStreamPacket[offset++];
+    if (offset + pointerField > xTS::TS_PacketLength)
+    {
+        m_NumLost++;
+        xSectionReset();
+        return eResult::SectionLost;
+    }
+    if (m_Started)
+    {
+        xConsume(&TransportStreamPacket[offset], pointerField, result);
+        if (m_Started)
+        {
+            m_NumLost++;
+            result = eResult::SectionLost;
+            xSectionReset();
+        }
+    }
+    offset += pointerField;
+
+    while (offset < xTS::TS_PacketLength && TransportStreamPacket[offset] != 0xFF)
+    {
+        m_Started = true;
+        offset += xConsume(&TransportStreamPacket[offset], xTS::TS_PacketLength - offset, result);
+    }
+    return result;
+}
+
+uint32_t xPSI_Assembler::xConsume(const uint8_t* Data, uint32_t Size, eResult& Result)
+{
+    uint32_t consumed = 0;
+    if (m_BufferSize < SectionHeaderLength)
+    {
+        uint32_t headerBytes = SectionHeaderLength - m_BufferSize;
+        if (headerBytes > Size) { headerBytes = Size; }
+        memcpy(m_Buffer + m_BufferSize, Data, headerBytes);
+        m_BufferSize += headerBytes;
+        consumed += headerBytes;
+        if (m_BufferSize < SectionHeaderLength)
+        {
+            return consumed;
+        }
+        m_SectionLength = SectionHeaderLength + ((((uint32_t)m_Buffer[1] & 0x0F) << 8) | m_Buffer[2]);
+        if (m_SectionLength > MaxSectionLength)
+        {
+            m_NumLost++;
+            if (Result < eResult::SectionLost) { Result = eResult::SectionLost; }
+            xSectionReset();
+            return Size;
+        }
+    }
+
+    uint32_t sectionBytes = m_SectionLength - m_BufferSize;
+    if (sectionBytes > Size - consumed) { sectionBytes = Size - consumed; }
+    memcpy(m_Buffer + m_BufferSize, Data + consumed, sectionBytes);
+    m_BufferSize += sectionBytes;
+    consumed += sectionBytes;
+
+    if (m_BufferSize == m_SectionLength)
+    {
+        // section_syntax_indicator == 0 sections (e.g. TDT) carry no CRC_32
+        bool hasCRC = (m_Buffer[1] & 0x80) != 0;
+        if (!hasCRC || xCRC32::CheckSection(m_Buffer, m_SectionLength))
+        {
+            m_NumValid++;
+            if (Result < eResult::SectionValid) { Result = eResult::SectionValid; }
+        }
+        else
+        {
+            m_NumCRCErrors++;
+            Result = eResult::SectionCRCError;
+        }
+        xSectionReset();
+    }
+    return consumed;
+}
+
+void xPSI_Assembler::xSectionReset()
+{
+    m_BufferSize = 0;
+    m_SectionLength = 0;
+    m_Started = false;
+}
@@ -2,6 +2,10 @@
 
 #pragma once
 #include "tsCommon.h"
+#include "tsBufferPool.h"
+#include "tsMemoryGovernor.h"
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <vector>
 using namespace std;
@@ -141,6 +145,13 @@ public:
 
     int32_t Parse(const uint8_t *PacketBuffer, uint8_t AdaptationFieldControl);
 
+    //adaptation_field_length only - enough for payload offset, other fields are left untouched
+    int32_t ParseLength(const uint8_t *PacketBuffer, uint8_t AdaptationFieldControl) {
+        m_AFC = AdaptationFieldControl;
+        m_AF = (m_AFC == 0x02 || m_AFC == 0x03) ? PacketBuffer[4] : 0;
+        return m_AF;
+    }
+
     void Print() const;
 
     uint32_t getNumBytes() const {
@@ -169,22 +180,29 @@ protected:
     uint8_t m_StreamId;
     uint16_t m_PacketLength;
     uint8_t m_HeaderLength;
+    uint8_t m_PES_CRC_flag;
+    uint16_t m_PreviousPESPacketCRC;
 
 public:
     void Reset();
-    int32_t Parse(const uint8_t *PacketBuffer);
+    //Length - bytes available at PacketBuffer (rest of the TS payload); a header longer than that is left to the caller
+    int32_t Parse(const uint8_t *PacketBuffer, uint32_t Length);
     void Print() const;
 
     uint32_t getPacketStartCodePrefix() const { return m_PacketStartCodePrefix; }
     uint8_t getStreamId() const { return m_StreamId; }
     uint16_t getPacketLength() const { return m_PacketLength; }
     uint8_t getHeaderLength() const { return m_HeaderLength; }
+    bool hasPreviousPESPacketCRC() const { return m_PES_CRC_flag; }
+    uint16_t getPreviousPESPacketCRC() const { return m_PreviousPESPacketCRC; }
 };
 
 //=============================================================================================================================================================================
 
 class xPES_Assembler {
 public:
+    static constexpr uint32_t BufferCapacity = 200000;
+
     enum class eResult : int32_t {
         UnexpectedPID = 1,
         StreamPacketLost,
@@ -192,31 +210,55 @@ public:
         AssemblingContinue,
         AssemblingFinished,
         NoPayload,
-        BufferOverflow
+        BufferOverflow,
+        Evicted
     };
 
 protected:
     int32_t m_PID;
     uint8_t *m_Buffer;
     uint32_t m_BufferSize;
+    xBufferPool *m_Pool;
+    xMemoryAccount m_MemoryAccount; //charged with m_BufferSize
     int8_t m_LastContinuityCounter;
     bool m_Started;
     xPES_PacketHeader m_PESH;
+    //previous_PES_packet_CRC - CRC-16 of previous PES data is calculated only once the stream is known to carry it
+    bool m_PESCRCPresent;
+    bool m_LastDataCRCValid;
+    uint16_t m_LastDataCRC;
+    int8_t m_DataCRCContinuityCounter; //not reset between PES - any gap means the previous PES may have been missed
+    uint32_t m_NumPESCRCErrors;
 
 public:
     xPES_Assembler();
 
     ~xPES_Assembler();
 
-    void Init(int32_t PID);
+    xPES_Assembler(const xPES_Assembler &) = delete;
+    xPES_Assembler &operator=(const xPES_Assembler &) = delete;
+
+    //Pool (optional) must hand out buffers of at least BufferCapacity bytes
+    //Governor (optional) caps pending PES bytes - AbsorbPacket returns Evicted when the PES had to be dropped
+    void Init(int32_t PID, xBufferPool *Pool = nullptr, xMemoryGovernor *Governor = nullptr);
 
     eResult AbsorbPacket(const uint8_t *TransportStreamPacket, const xTS_PacketHeader *PacketHeader,
                          const xTS_AdaptationField *AdaptationField);
 
+    //AbsorbPacket for callers that already matched the PID (xTS_Pipeline's PID filter); AdaptationFieldBytes - 0 or
+    //adaptation_field_length + 1. Defined inline so the pipeline's packet loop compiles the continuation path in place.
+    eResult AbsorbMatched(const uint8_t *TransportStreamPacket, const xTS_PacketHeader &PacketHeader,
+                          uint32_t AdaptationFieldBytes);
+
+    //drops the PES being assembled, has to be called after AssemblingFinished before the next PES starts
+    void Reset() { xBufferReset(); }
+
     void PrintPESH() const {m_PESH.Print();};
     uint8_t *getPacket() { return m_Buffer; }
     int32_t getNumPacketBytes() const { return m_BufferSize; }
     uint8_t getHeaderLength() const { return m_PESH.getHeaderLength(); }
+    uint32_t getNumPESCRCErrors() const { return m_NumPESCRCErrors; }
+    bool isAssembling() const { return m_Started; }
 
     void assemblerPes(const uint8_t *TS_PacketBuffer, const xTS_PacketHeader *TS_PacketHeader,
                       const xTS_AdaptationField *TS_AdaptationField, FILE *AudioMP2);
@@ -224,7 +266,132 @@ public:
     void saveBufferToFile(FILE *AudioMP2);
 
 protected:
+    //PUSI packet - parses the PES header and starts a new PES
+    eResult xAbsorbStart(const uint8_t *TransportStreamPacket, uint32_t PayloadOffset, uint32_t PayloadLength);
+
+    eResult xDropPES(eResult Result);
+
     void xBufferReset();
 
-    void xBufferAppend(const uint8_t *Data, uint32_t Size);
+    void xBufferAppend(const uint8_t *Data, uint32_t Size) {
+        if (m_Buffer && (m_BufferSize + Size) <= BufferCapacity) {
+            memcpy(m_Buffer + m_BufferSize, Data, Size);
+            m_BufferSize += Size;
+        }
+    }
+
+    void xBufferClear();
+
+    void xBufferRelease();
+
+    void xUpdateDataCRC();
+};
+
+inline xPES_Assembler::eResult xPES_Assembler::AbsorbMatched(const uint8_t *TransportStreamPacket,
+                                                             const xTS_PacketHeader &PacketHeader,
+                                                             uint32_t AdaptationFieldBytes) {
+    // under global memory pressure the PES in progress is dropped (a PUSI packet drops it anyway)
+    if (m_Started && !PacketHeader.getPayloadUnitStartIndicator() && m_MemoryAccount.TakeShedRequest()) {
+        return xDropPES(eResult::Evicted);
+    }
+
+    uint8_t currentCC = PacketHeader.getCC();
+
+    // CC only advances on packets with payload - adaptation-field-only packets (e.g. PCR) repeat it
+    if (m_PESCRCPresent && PacketHeader.hasContinuityCounter() && PacketHeader.hasPayload()) {
+        if (m_DataCRCContinuityCounter != -1 && ((m_DataCRCContinuityCounter + 1) & 0x0F) != currentCC) {
+            m_LastDataCRCValid = false;
+        }
+        m_DataCRCContinuityCounter = currentCC;
+    }
+
+    if (m_Started && PacketHeader.hasContinuityCounter() && m_LastContinuityCounter != -1 &&
+        ((m_LastContinuityCounter + 1) & 0x0F) != currentCC) {
+        m_LastContinuityCounter = -1;
+        return xDropPES(eResult::StreamPacketLost);
+    }
+    m_LastContinuityCounter = currentCC;
+
+    uint32_t payloadOffset = xTS::TS_HeaderLength + AdaptationFieldBytes;
+
+    // a corrupted adaptation_field_length may cover the whole packet
+    if (!PacketHeader.hasPayload() || payloadOffset >= xTS::TS_PacketLength) {
+        return eResult::NoPayload;
+    }
+    uint32_t tsPayloadLength = xTS::TS_PacketLength - payloadOffset;
+
+    if (PacketHeader.getPayloadUnitStartIndicator()) {
+        return xAbsorbStart(TransportStreamPacket, payloadOffset, tsPayloadLength);
+    }
+    if (!m_Started) {
+        return eResult::UnexpectedPID;
+    }
+
+    if (m_BufferSize + tsPayloadLength > BufferCapacity) {
+        m_Started = false;
+        return eResult::BufferOverflow;
+    }
+    if (!m_MemoryAccount.Charge(tsPayloadLength)) {
+        m_Started = false;
+        return eResult::Evicted;
+    }
+    xBufferAppend(&TransportStreamPacket[payloadOffset], tsPayloadLength);
+
+    if (m_PESH.getPacketLength() > 0 && (m_BufferSize + m_PESH.getHeaderLength()) >= (m_PESH.getPacketLength() + 6u)) {
+        m_Started = false;
+        xUpdateDataCRC();
+        return eResult::AssemblingFinished;
+    }
+    return eResult::AssemblingContinue;
+}
+
+//=============================================================================================================================================================================
+
+class xPSI_Assembler {
+public:
+    static constexpr uint32_t MaxSectionLength = 4096; //private_section upper bound (3 + 4093)
+    static constexpr uint32_t SectionHeaderLength = 3;
+
+    enum class eResult : int32_t {
+        UnexpectedPID = 1,
+        NoPayload,
+        AssemblingContinue,
+        SectionValid,
+        SectionLost,
+        SectionCRCError
+    };
+
+protected:
+    int32_t m_PID;
+    uint8_t m_Buffer[MaxSectionLength];
+    uint32_t m_BufferSize;
+    uint32_t m_SectionLength;
+    int8_t m_LastContinuityCounter;
+    bool m_Started;
+    uint32_t m_NumValid;
+    uint32_t m_NumCRCErrors;
+    uint32_t m_NumLost;
+
+public:
+    xPSI_Assembler();
+
+    void Init(int32_t PID);
+
+    eResult AbsorbPacket(const uint8_t *TransportStreamPacket, const xTS_PacketHeader *PacketHeader,
+                         const xTS_AdaptationField *AdaptationField);
+
+    //AbsorbPacket for callers that already matched the PID (xTS_Pipeline's PID filter); AdaptationFieldBytes - 0 or
+    //adaptation_field_length + 1. Defined inline so the pipeline's packet loop compiles the continuation path in place.
+    eResult AbsorbMatched(const uint8_t *TransportStreamPacket, const xTS_PacketHeader &PacketHeader,
+                          uint32_t AdaptationFieldBytes);
+
+    int32_t getPID() const { return m_PID; }
+    uint32_t getNumValid() const { return m_NumValid; }
+    uint32_t getNumCRCErrors() const { return m_NumCRCErrors; }
+    uint32_t getNumLost() const { return m_NumLost; }
+
+protected:
+    uint32_t xConsume(const uint8_t *Data, uint32_t Size, eResult &Result);
+
+    void xSectionReset();
 };
\ No newline at end of file